@@ -0,0 +1,208 @@
+#include "affix.hpp"
+#include <string.h>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define AFFIX_SSE2
+#if defined(__GNUC__)
+#define AFFIX_AVX
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define AFFIX_NEON
+#endif
+
+static auto load_word(char const* src) noexcept -> std::uint64_t {
+    auto word = std::uint64_t {};
+    ::memcpy(&word, src, sizeof(word));
+    return word;
+}
+
+// bytes that agree at the start of the word, first in memory is lowest on little endian
+static auto agree_forward(std::uint64_t diff) noexcept -> std::size_t {
+    if constexpr (std::endian::native == std::endian::little) {
+        return static_cast<std::size_t>(std::countr_zero(diff)) / 8;
+    } else {
+        return static_cast<std::size_t>(std::countl_zero(diff)) / 8;
+    }
+}
+
+static auto agree_backward(std::uint64_t diff) noexcept -> std::size_t {
+    if constexpr (std::endian::native == std::endian::little) {
+        return static_cast<std::size_t>(std::countl_zero(diff)) / 8;
+    } else {
+        return static_cast<std::size_t>(std::countr_zero(diff)) / 8;
+    }
+}
+
+// lhs and rhs point at the start, size bytes are compared
+static auto prefix_words(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        if (auto const diff = load_word(lhs + i) ^ load_word(rhs + i)) {
+            return i + agree_forward(diff);
+        }
+    }
+    for (; i != size && lhs[i] == rhs[i]; ++i) {}
+    return i;
+}
+
+// lhs and rhs point one past the end, size bytes before that are compared
+static auto suffix_words(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        if (auto const diff = load_word(lhs - i - 8) ^ load_word(rhs - i - 8)) {
+            return i + agree_backward(diff);
+        }
+    }
+    for (; i != size && lhs[-1 - static_cast<std::ptrdiff_t>(i)] == rhs[-1 - static_cast<std::ptrdiff_t>(i)]; ++i) {}
+    return i;
+}
+
+#ifdef AFFIX_SSE2
+// bit i of the result is set when byte i differs
+static auto differ_sse2(char const* lhs, char const* rhs) noexcept -> std::uint32_t {
+    auto const equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(lhs)),
+                                      _mm_loadu_si128(reinterpret_cast<__m128i const*>(rhs)));
+    return ~static_cast<std::uint32_t>(_mm_movemask_epi8(equal)) & 0xFFFFu;
+}
+
+static auto prefix_vectors(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        if (auto const differ = differ_sse2(lhs + i, rhs + i)) {
+            return i + static_cast<std::size_t>(std::countr_zero(differ));
+        }
+    }
+    return i + prefix_words(lhs + i, rhs + i, size - i);
+}
+
+static auto suffix_vectors(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        if (auto const differ = differ_sse2(lhs - i - 16, rhs - i - 16)) {
+            return i + static_cast<std::size_t>(std::countl_zero(differ << 16));
+        }
+    }
+    return i + suffix_words(lhs - i, rhs - i, size - i);
+}
+#elif defined(AFFIX_NEON)
+// one nibble per byte, set when the byte differs
+static auto differ_neon(char const* lhs, char const* rhs) noexcept -> std::uint64_t {
+    auto const equal = vceqq_u8(vld1q_u8(reinterpret_cast<std::uint8_t const*>(lhs)),
+                                vld1q_u8(reinterpret_cast<std::uint8_t const*>(rhs)));
+    auto const nibbles = vshrn_n_u16(vreinterpretq_u16_u8(equal), 4);
+    return ~vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+
+static auto prefix_vectors(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        if (auto const differ = differ_neon(lhs + i, rhs + i)) {
+            return i + static_cast<std::size_t>(std::countr_zero(differ)) / 4;
+        }
+    }
+    return i + prefix_words(lhs + i, rhs + i, size - i);
+}
+
+static auto suffix_vectors(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        if (auto const differ = differ_neon(lhs - i - 16, rhs - i - 16)) {
+            return i + static_cast<std::size_t>(std::countl_zero(differ)) / 4;
+        }
+    }
+    return i + suffix_words(lhs - i, rhs - i, size - i);
+}
+#else
+static auto prefix_vectors(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    return prefix_words(lhs, rhs, size);
+}
+
+static auto suffix_vectors(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    return suffix_words(lhs, rhs, size);
+}
+#endif
+
+#ifdef AFFIX_AVX
+// built for the wider units regardless of compiler flags, only called once the cpu reports them
+__attribute__((target("avx2")))
+static auto prefix_avx2(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        auto const equal = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(lhs + i)),
+                                             _mm256_loadu_si256(reinterpret_cast<__m256i const*>(rhs + i)));
+        if (auto const differ = ~static_cast<std::uint32_t>(_mm256_movemask_epi8(equal))) {
+            return i + static_cast<std::size_t>(std::countr_zero(differ));
+        }
+    }
+    return i + prefix_vectors(lhs + i, rhs + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static auto suffix_avx2(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        auto const equal = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(lhs - i - 32)),
+                                             _mm256_loadu_si256(reinterpret_cast<__m256i const*>(rhs - i - 32)));
+        if (auto const differ = ~static_cast<std::uint32_t>(_mm256_movemask_epi8(equal))) {
+            return i + static_cast<std::size_t>(std::countl_zero(differ));
+        }
+    }
+    return i + suffix_vectors(lhs - i, rhs - i, size - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static auto prefix_avx512(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    std::size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        auto const differ = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(lhs + i), _mm512_loadu_si512(rhs + i));
+        if (differ != 0) {
+            return i + static_cast<std::size_t>(std::countr_zero(static_cast<std::uint64_t>(differ)));
+        }
+    }
+    return i + prefix_vectors(lhs + i, rhs + i, size - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static auto suffix_avx512(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    std::size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        auto const differ = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(lhs - i - 64), _mm512_loadu_si512(rhs - i - 64));
+        if (differ != 0) {
+            return i + static_cast<std::size_t>(std::countl_zero(static_cast<std::uint64_t>(differ)));
+        }
+    }
+    return i + suffix_vectors(lhs - i, rhs - i, size - i);
+}
+#endif
+
+auto common_prefix_size(std::span<char const> lhs, std::span<char const> rhs) noexcept -> std::size_t {
+    auto const size = std::min(lhs.size(), rhs.size());
+#ifdef AFFIX_AVX
+    if (__builtin_cpu_supports("avx512bw")) {
+        return prefix_avx512(lhs.data(), rhs.data(), size);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return prefix_avx2(lhs.data(), rhs.data(), size);
+    }
+#endif
+    return prefix_vectors(lhs.data(), rhs.data(), size);
+}
+
+auto common_suffix_size(std::span<char const> lhs, std::span<char const> rhs) noexcept -> std::size_t {
+    auto const size = std::min(lhs.size(), rhs.size());
+    auto const lhs_end = lhs.data() + lhs.size();
+    auto const rhs_end = rhs.data() + rhs.size();
+#ifdef AFFIX_AVX
+    if (__builtin_cpu_supports("avx512bw")) {
+        return suffix_avx512(lhs_end, rhs_end, size);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return suffix_avx2(lhs_end, rhs_end, size);
+    }
+#endif
+    return suffix_vectors(lhs_end, rhs_end, size);
+}
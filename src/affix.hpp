@@ -0,0 +1,8 @@
+#pragma once
+#include <cstddef>
+#include <span>
+
+// Longest common prefix and suffix of two buffers, compared a vector at a time, 64 bytes with AVX-512,
+// 32 with AVX2 when the cpu has them, 16 with SSE2 or NEON otherwise, 8 bytes at a time anywhere else.
+[[nodiscard]] auto common_prefix_size(std::span<char const> lhs, std::span<char const> rhs) noexcept -> std::size_t;
+[[nodiscard]] auto common_suffix_size(std::span<char const> lhs, std::span<char const> rhs) noexcept -> std::size_t;
@@ -0,0 +1,263 @@
+#include "branch_filter.hpp"
+#include <algorithm>
+#include <array>
+
+constexpr std::uint16_t elf_machine_x86_64 = 62;
+constexpr std::uint16_t elf_machine_aarch64 = 183;
+constexpr std::uint32_t elf_section_progbits = 1;
+constexpr std::uint64_t elf_section_alloc = 2;
+constexpr std::uint64_t elf_section_execinstr = 4;
+constexpr std::size_t elf_header_size = 64;
+constexpr std::size_t elf_section_header_size = 64;
+
+constexpr std::uint16_t pe_machine_x86_64 = 0x8664;
+constexpr std::uint16_t pe_machine_aarch64 = 0xAA64;
+constexpr std::uint32_t pe_section_code = 0x20;
+constexpr std::uint32_t pe_section_execute = 0x20000000;
+constexpr std::size_t pe_section_header_size = 40;
+
+static auto load_le(char const* src, std::size_t size) noexcept -> std::uint64_t {
+    auto value = std::uint64_t {};
+    for (std::size_t i = 0; i != size; ++i) {
+        value |= std::uint64_t { static_cast<unsigned char>(src[i]) } << (8 * i);
+    }
+    return value;
+}
+
+static auto store_le32(char* dst, std::uint32_t value) noexcept -> void {
+    for (std::size_t i = 0; i != 4; ++i) {
+        dst[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+// headers have to stay untouched, filtered data gets parsed again on the other side
+struct HeaderRange {
+    std::uint64_t pos;
+    std::uint64_t size;
+};
+
+// keeps sections inside data, away from headers and from each other
+static auto add_section(CodeSections& code, std::span<char const> data, std::span<HeaderRange const> headers,
+                        CodeSection const& section) noexcept -> void {
+    if (section.size == 0 || section.pos > data.size() || section.size > data.size() - section.pos) {
+        return;
+    }
+    for (auto const& header : headers) {
+        if (section.pos < header.pos + header.size && header.pos < section.pos + section.size) {
+            return;
+        }
+    }
+    code.sections.push_back(section);
+}
+
+static auto add_to_image(CodeSections& code, std::uint64_t address, std::uint64_t size) noexcept -> void {
+    if (size == 0 || address + size < address) {
+        return;
+    }
+    if (code.image_begin == code.image_end) {
+        code.image_begin = address;
+        code.image_end = address + size;
+    }
+    code.image_begin = std::min(code.image_begin, address);
+    code.image_end = std::max(code.image_end, address + size);
+}
+
+static auto sort_sections(CodeSections& code) noexcept -> void {
+    std::sort(code.sections.begin(), code.sections.end(), [] (CodeSection const& lhs, CodeSection const& rhs) {
+        return lhs.pos < rhs.pos;
+    });
+    auto end = std::uint64_t {};
+    std::erase_if(code.sections, [&] (CodeSection const& section) {
+        if (section.pos < end) {
+            return true;
+        }
+        end = section.pos + section.size;
+        return false;
+    });
+}
+
+static auto find_elf_sections(std::span<char const> data) noexcept -> CodeSections {
+    auto code = CodeSections {};
+    auto const src = data.data();
+    // 64bit little endian only, that is all either architecture uses
+    if (data.size() < elf_header_size || load_le(src, 4) != 0x464C457Fu || src[4] != 2 || src[5] != 1) {
+        return code;
+    }
+    auto const machine = load_le(src + 18, 2);
+    auto const arch = machine == elf_machine_x86_64 ? BranchArch::x86_64
+        : machine == elf_machine_aarch64 ? BranchArch::aarch64
+        : BranchArch::none;
+    auto const program_pos = load_le(src + 32, 8);
+    auto const section_pos = load_le(src + 40, 8);
+    auto const program_size = load_le(src + 54, 2) * load_le(src + 56, 2);
+    auto const section_count = load_le(src + 60, 2);
+    if (arch == BranchArch::none || load_le(src + 58, 2) != elf_section_header_size
+        || section_pos > data.size() || section_count > (data.size() - section_pos) / elf_section_header_size) {
+        return code;
+    }
+    auto const headers = std::array {
+        HeaderRange { 0, elf_header_size },
+        HeaderRange { program_pos, program_size },
+        HeaderRange { section_pos, section_count * elf_section_header_size },
+    };
+    code.arch = arch;
+    for (std::size_t i = 0; i != section_count; ++i) {
+        auto const header = src + section_pos + i * elf_section_header_size;
+        auto const flags = load_le(header + 8, 8);
+        if (flags & elf_section_alloc) {
+            add_to_image(code, load_le(header + 16, 8), load_le(header + 32, 8));
+        }
+        if (load_le(header + 4, 4) != elf_section_progbits || (flags & elf_section_execinstr) == 0) {
+            continue;
+        }
+        add_section(code, data, headers, { load_le(header + 24, 8), load_le(header + 32, 8), load_le(header + 16, 8) });
+    }
+    sort_sections(code);
+    return code;
+}
+
+static auto find_pe_sections(std::span<char const> data) noexcept -> CodeSections {
+    auto code = CodeSections {};
+    auto const src = data.data();
+    if (data.size() < 64 || load_le(src, 2) != 0x5A4Du) {
+        return code;
+    }
+    auto const pe_pos = load_le(src + 60, 4);
+    if (pe_pos > data.size() - 24 || load_le(src + pe_pos, 4) != 0x4550u) {
+        return code;
+    }
+    auto const machine = load_le(src + pe_pos + 4, 2);
+    auto const arch = machine == pe_machine_x86_64 ? BranchArch::x86_64
+        : machine == pe_machine_aarch64 ? BranchArch::aarch64
+        : BranchArch::none;
+    auto const section_count = load_le(src + pe_pos + 6, 2);
+    auto const section_pos = pe_pos + 24 + load_le(src + pe_pos + 20, 2);
+    if (arch == BranchArch::none || section_pos > data.size()
+        || section_count > (data.size() - section_pos) / pe_section_header_size) {
+        return code;
+    }
+    // everything up to the end of the section table, dos stub and optional header included
+    auto const headers = std::array {
+        HeaderRange { 0, section_pos + section_count * pe_section_header_size },
+    };
+    code.arch = arch;
+    for (std::size_t i = 0; i != section_count; ++i) {
+        auto const header = src + section_pos + i * pe_section_header_size;
+        // raw data is padded to file alignment, virtual size is what actually got loaded
+        auto const virtual_size = load_le(header + 8, 4);
+        auto const raw_size = load_le(header + 16, 4);
+        add_to_image(code, load_le(header + 12, 4), std::max(virtual_size, raw_size));
+        if ((load_le(header + 36, 4) & (pe_section_code | pe_section_execute)) == 0) {
+            continue;
+        }
+        auto const size = virtual_size != 0 ? std::min(virtual_size, raw_size) : raw_size;
+        add_section(code, data, headers, { load_le(header + 20, 4), size, load_le(header + 12, 4) });
+    }
+    sort_sections(code);
+    return code;
+}
+
+auto find_code_sections(std::span<char const> data) noexcept -> CodeSections {
+    if (auto code = find_elf_sections(data); code.arch != BranchArch::none) {
+        return code;
+    }
+    return find_pe_sections(data);
+}
+
+// Part of the image a branch can leave its section for, addresses are reduced modulo the displacement range.
+struct TargetRegion {
+    std::uint32_t pos;
+    std::uint32_t size;
+};
+
+// intervals [pos, pos + size) modulo mask + 1
+static auto disjoint(TargetRegion const& lhs, TargetRegion const& rhs, std::uint32_t mask) noexcept -> bool {
+    return ((rhs.pos - lhs.pos) & mask) >= lhs.size && ((lhs.pos - rhs.pos) & mask) >= rhs.size;
+}
+
+// Displacements from next into a region trade places with the region's biased absolute addresses, everything else
+// stays. That is its own inverse, and as it only depends on where the branch is, decoding takes the same decisions.
+// Swaps that would overlap each other are skipped, they only happen for images close to the displacement range.
+static auto swap_target(std::uint32_t value, std::uint32_t next, std::span<TargetRegion const> regions,
+                        std::uint32_t bias, std::uint32_t mask) noexcept -> std::uint32_t {
+    for (auto const& region : regions) {
+        for (auto const& other : regions) {
+            if (!disjoint({ region.pos - next, region.size }, { other.pos + bias, other.size }, mask)) {
+                return value;
+            }
+        }
+    }
+    for (auto const& region : regions) {
+        auto const relative = (region.pos - next) & mask;
+        auto const absolute = (region.pos + bias) & mask;
+        if (((value - relative) & mask) < region.size) {
+            return (value - relative + absolute) & mask;
+        }
+        if (((value - absolute) & mask) < region.size) {
+            return (value - absolute + relative) & mask;
+        }
+    }
+    return value;
+}
+
+// call, jmp and their rip relative indirect forms with 32bit displacement, every opcode skips its operand
+static auto filter_x86_64(char* src, std::uint64_t size, std::uint64_t address,
+                          std::span<TargetRegion const> regions) noexcept -> void {
+    for (std::uint64_t i = 0; i + 6 <= size;) {
+        auto const opcode = static_cast<unsigned char>(src[i]);
+        auto const modrm = static_cast<unsigned char>(src[i + 1]);
+        auto operand = std::uint64_t {};
+        if (opcode == 0xE8 || opcode == 0xE9) {
+            operand = 1;
+        } else if (opcode == 0xFF && (modrm == 0x15 || modrm == 0x25)) {
+            operand = 2;
+        } else {
+            ++i;
+            continue;
+        }
+        auto const next = static_cast<std::uint32_t>(address + i + operand + 4);
+        auto const value = static_cast<std::uint32_t>(load_le(src + i + operand, 4));
+        store_le32(src + i + operand, swap_target(value, next, regions, 0x80000000u, 0xFFFFFFFFu));
+        i += operand + 4;
+    }
+}
+
+// bl with its 26bit word offset, instructions are aligned so every word is decided on its own
+static auto filter_aarch64(char* src, std::uint64_t size, std::uint64_t address,
+                           std::span<TargetRegion const> regions) noexcept -> void {
+    for (auto i = (4 - address % 4) % 4; i + 4 <= size; i += 4) {
+        auto const instruction = static_cast<std::uint32_t>(load_le(src + i, 4));
+        if ((instruction & 0xFC000000u) != 0x94000000u) {
+            continue;
+        }
+        auto const pc = static_cast<std::uint32_t>((address + i) >> 2);
+        store_le32(src + i, 0x94000000u | swap_target(instruction & 0x03FFFFFFu, pc, regions, 0x02000000u, 0x03FFFFFFu));
+    }
+}
+
+auto filter_branches(std::span<char> data, CodeSections const& code) noexcept -> void {
+    // aarch64 counts in words, regions have to stay well inside the displacement range
+    auto const shift = code.arch == BranchArch::aarch64 ? 2 : 0;
+    if (code.image_end - code.image_begin >= (std::uint64_t { 1 } << (shift + 24))) {
+        return;
+    }
+    for (auto const& section : code.sections) {
+        if (section.pos > data.size() || section.size > data.size() - section.pos
+            || section.address < code.image_begin || section.address + section.size > code.image_end) {
+            continue;
+        }
+        // targets outside of the section keep their address when code inside it moves
+        auto const before_size = static_cast<std::uint32_t>((section.address - code.image_begin) >> shift);
+        auto const after_pos = static_cast<std::uint32_t>((section.address + section.size + (1 << shift) - 1) >> shift);
+        auto const after_size = static_cast<std::uint32_t>(((code.image_end + (1 << shift) - 1) >> shift) - after_pos);
+        auto const regions = std::array {
+            TargetRegion { static_cast<std::uint32_t>(code.image_begin >> shift), before_size },
+            TargetRegion { after_pos, after_size },
+        };
+        if (code.arch == BranchArch::x86_64) {
+            filter_x86_64(data.data() + section.pos, section.size, section.address, regions);
+        } else if (code.arch == BranchArch::aarch64) {
+            filter_aarch64(data.data() + section.pos, section.size, section.address, regions);
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+enum class BranchArch : std::uint32_t {
+    none = 0,
+    x86_64 = 1,
+    aarch64 = 2,
+};
+
+// Executable section, address is where its first byte gets loaded.
+struct CodeSection {
+    std::uint64_t pos;
+    std::uint64_t size;
+    std::uint64_t address;
+};
+
+struct CodeSections {
+    BranchArch arch = BranchArch::none;
+    // sorted by position and never overlapping
+    std::vector<CodeSection> sections = {};
+    // addresses the loaded sections span, code and data
+    std::uint64_t image_begin = {};
+    std::uint64_t image_end = {};
+};
+
+// Code sections of a 64bit little endian ELF or PE file for x86-64 or AArch64, none for anything else.
+// Sections overlapping the headers are left out, so filtered data still yields the same sections.
+[[nodiscard]] auto find_code_sections(std::span<char const> data) noexcept -> CodeSections;
+
+// Turns relative targets of calls and jumps that leave their section into absolute ones, like the BCJ filters of xz.
+// Code shifted by a few bytes then still calls imports and other sections with the same bytes, branches within
+// a section move along with it and stay relative. Filtering twice with the same sections restores the data.
+auto filter_branches(std::span<char> data, CodeSections const& code) noexcept -> void;
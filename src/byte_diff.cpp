@@ -0,0 +1,135 @@
+#include "byte_diff.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+
+// smaller sections are not worth a thread
+constexpr std::size_t section_size_min = std::size_t { 16 } << 20;
+// exact match needs this many more bytes than the current alignment before it starts a new extent
+constexpr std::int64_t realign_gain_min = 8;
+
+// scan new file from begin to end, extents are bsdiff's diff blocks and the bytes between them its extra blocks
+static auto scan_section(SuffixArray const& old_suffixes,
+                         std::span<char const> old_data, std::span<char const> new_data,
+                         std::size_t begin, std::size_t end,
+                         std::vector<DiffExtent>& out) noexcept -> void {
+    auto const old = old_data.data();
+    auto const old_size = old_data.size();
+    auto const src = new_data.data();
+    // offset is old minus new position, wrapping around keeps negative ones out of range of old file
+    auto const agrees = [&] (std::uint64_t new_pos, std::uint64_t offset) noexcept -> std::int64_t {
+        auto const old_pos = new_pos + offset;
+        return old_pos < old_size && old[old_pos] == src[new_pos];
+    };
+    auto scan = begin;
+    auto length = std::size_t {};
+    auto match_pos = std::uint64_t {};
+    auto last_scan = begin;
+    auto last_pos = std::uint64_t {};
+    auto last_offset = std::uint64_t {};
+    while (scan < end) {
+        // bytes the current alignment gets right over the extent of the exact match
+        auto score = std::int64_t {};
+        auto scored = scan += length;
+        for (; scan < end; ++scan) {
+            auto const match = old_suffixes.longest_match(src + scan, end - scan);
+            length = match.length;
+            match_pos = match.pos;
+            for (; scored < scan + length; ++scored) {
+                score += agrees(scored, last_offset);
+            }
+            auto const gain = static_cast<std::int64_t>(length) - score;
+            if ((gain == 0 && length != 0) || gain > realign_gain_min) {
+                break;
+            }
+            score -= agrees(scan, last_offset);
+        }
+        if (static_cast<std::int64_t>(length) == score && scan != end) {
+            continue;
+        }
+        // grow previous alignment forward and the new match backward while more bytes agree than not
+        auto forward = std::size_t {};
+        auto best = std::int64_t {};
+        auto agreed = std::int64_t {};
+        for (std::size_t i = 0; last_scan + i < scan && last_pos + i < old_size;) {
+            agreed += old[last_pos + i] == src[last_scan + i];
+            ++i;
+            if (agreed * 2 - static_cast<std::int64_t>(i) > best * 2 - static_cast<std::int64_t>(forward)) {
+                best = agreed;
+                forward = i;
+            }
+        }
+        auto backward = std::size_t {};
+        if (scan < end) {
+            best = 0;
+            agreed = 0;
+            for (std::size_t i = 1; scan >= last_scan + i && match_pos >= i; ++i) {
+                agreed += old[match_pos - i] == src[scan - i];
+                if (agreed * 2 - static_cast<std::int64_t>(i) > best * 2 - static_cast<std::int64_t>(backward)) {
+                    best = agreed;
+                    backward = i;
+                }
+            }
+        }
+        // both grew into each other, split where the bytes agree best
+        if (last_scan + forward > scan - backward) {
+            auto const overlap = last_scan + forward - (scan - backward);
+            auto split = std::size_t {};
+            best = 0;
+            agreed = 0;
+            for (std::size_t i = 0; i != overlap; ++i) {
+                agreed += src[last_scan + forward - overlap + i] == old[last_pos + forward - overlap + i];
+                agreed -= src[scan - backward + i] == old[match_pos - backward + i];
+                if (agreed > best) {
+                    best = agreed;
+                    split = i + 1;
+                }
+            }
+            forward += split - overlap;
+            backward -= split;
+        }
+        if (forward != 0) {
+            out.push_back({ last_scan, last_pos, forward });
+        }
+        last_scan = scan - backward;
+        last_pos = match_pos - backward;
+        last_offset = match_pos - scan;
+    }
+}
+
+auto find_diff_extents(SuffixArray const& old_suffixes,
+                       std::span<char const> old_data, std::span<char const> new_data,
+                       unsigned threads) noexcept -> std::vector<DiffExtent> {
+    auto const section_count = std::clamp(new_data.size() / section_size_min, std::size_t { 1 },
+                                          std::size_t { std::max(threads, 1u) });
+    auto const section_size = new_data.size() / section_count;
+    auto sections = std::vector<std::vector<DiffExtent>>(section_count);
+    auto workers = std::vector<std::thread>();
+    for (std::size_t i = 0; i != section_count; ++i) {
+        auto const pos = i * section_size;
+        auto const end = i + 1 == section_count ? new_data.size() : pos + section_size;
+        workers.emplace_back([&, pos, end, i] () noexcept {
+            scan_section(old_suffixes, old_data, new_data, pos, end, sections[i]);
+        });
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    auto extents = static_cast<std::vector<DiffExtent>&&>(sections.front());
+    for (std::size_t i = 1; i != section_count; ++i) {
+        extents.insert(extents.end(), sections[i].begin(), sections[i].end());
+    }
+    return extents;
+}
+
+auto subtract_extents(std::span<char const> old_data, std::span<char const> new_data,
+                      std::span<DiffExtent const> extents, char* out) noexcept -> void {
+    std::copy(new_data.begin(), new_data.end(), out);
+    for (auto const& extent : extents) {
+        auto const old = old_data.data() + extent.old_pos;
+        auto const dst = out + extent.new_pos;
+        for (std::size_t i = 0; i != extent.size; ++i) {
+            dst[i] = static_cast<char>(static_cast<unsigned char>(dst[i]) - static_cast<unsigned char>(old[i]));
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <span>
+#include <vector>
+#include "records.hpp"
+#include "suffix_array.hpp"
+
+// bsdiff style alignment, extents where new file is old file with a few bytes changed, like code with shifted addresses.
+// Exact matches found through the suffix array seed them, they grow as long as more than half of the bytes agree.
+// Sections of new file are scanned on separate threads, sorted by new position and never overlapping.
+[[nodiscard]] auto find_diff_extents(SuffixArray const& old_suffixes,
+                                     std::span<char const> old_data, std::span<char const> new_data,
+                                     unsigned threads) noexcept -> std::vector<DiffExtent>;
+
+// Copies new file to out with every extent replaced by new minus old, which is mostly zeros.
+auto subtract_extents(std::span<char const> old_data, std::span<char const> new_data,
+                      std::span<DiffExtent const> extents, char* out) noexcept -> void;
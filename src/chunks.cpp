@@ -0,0 +1,287 @@
+#include "chunks.hpp"
+#include <algorithm>
+#include <array>
+#include <string.h>
+#include <thread>
+#include <utility>
+#include "common/xxhash.h"
+
+constexpr std::size_t chunk_size_min = std::size_t { 16 } << 10;
+constexpr std::size_t chunk_size_max = std::size_t { 256 } << 10;
+// boundary once the top 16 bits of the gear hash are zero, they depend on the last 64 bytes only
+constexpr auto boundary_mask = ~std::uint64_t {} << (64 - 16);
+// smaller sections are not worth a thread
+constexpr std::size_t section_size_min = std::size_t { 64 } << 20;
+// gear hash only depends on this many bytes up to its position, matches shorter than that are collisions
+constexpr std::size_t gear_span = 64;
+// fingerprint once the top 7 bits of the gear hash are zero
+constexpr auto fingerprint_mask = ~std::uint64_t {} << (64 - 7);
+
+// fixed pseudo random table, chunks of diff and patch runs have to agree across builds
+constexpr auto gear_table = [] {
+    auto table = std::array<std::uint64_t, 256> {};
+    auto state = std::uint64_t { 0x9E3779B97F4A7C15u };
+    for (auto& entry : table) {
+        state += 0x9E3779B97F4A7C15u;
+        auto mixed = state;
+        mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9u;
+        mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBu;
+        entry = mixed ^ (mixed >> 31);
+    }
+    return table;
+}();
+
+static auto chunk_section(char const* data, std::size_t size, std::uint64_t base,
+                          std::vector<Chunk>& out) noexcept -> void {
+    std::size_t start = 0;
+    while (start != size) {
+        auto const left = size - start;
+        auto end = start + std::min(left, chunk_size_max);
+        // bytes below the minimum size are never a boundary so hashing them can be skipped
+        auto hash = std::uint64_t {};
+        for (auto pos = start + std::min(left, chunk_size_min); pos < end; ++pos) {
+            hash = (hash << 1) + gear_table[static_cast<unsigned char>(data[pos])];
+            if ((hash & boundary_mask) == 0) {
+                end = pos + 1;
+                break;
+            }
+        }
+        out.push_back({ base + start, end - start, XXH64(data + start, end - start, 0) });
+        start = end;
+    }
+}
+
+auto chunk_data(std::span<char const> data, unsigned threads) noexcept -> std::vector<Chunk> {
+    auto const section_count = std::clamp(data.size() / section_size_min, std::size_t { 1 },
+                                          std::size_t { std::max(threads, 1u) });
+    auto const section_size = data.size() / section_count;
+    auto sections = std::vector<std::vector<Chunk>>(section_count);
+    auto workers = std::vector<std::thread>();
+    for (std::size_t i = 0; i != section_count; ++i) {
+        auto const pos = i * section_size;
+        auto const size = i + 1 == section_count ? data.size() - pos : section_size;
+        workers.emplace_back([&, pos, size, i] () noexcept {
+            chunk_section(data.data() + pos, size, pos, sections[i]);
+        });
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    auto chunks = static_cast<std::vector<Chunk>&&>(sections.front());
+    for (std::size_t i = 1; i != section_count; ++i) {
+        chunks.insert(chunks.end(), sections[i].begin(), sections[i].end());
+    }
+    return chunks;
+}
+
+ChunkIndex::ChunkIndex(std::span<Chunk const> chunks) noexcept
+    : sorted_(chunks.begin(), chunks.end()) {
+    std::stable_sort(this->sorted_.begin(), this->sorted_.end(), [] (Chunk const& lhs, Chunk const& rhs) {
+        return lhs.hash < rhs.hash;
+    });
+}
+
+auto ChunkIndex::find(std::uint64_t hash) const noexcept -> Chunk const* {
+    auto const it = std::lower_bound(this->sorted_.begin(), this->sorted_.end(), hash,
+                                     [] (Chunk const& chunk, std::uint64_t value) {
+        return chunk.hash < value;
+    });
+    return it != this->sorted_.end() && it->hash == hash ? &*it : nullptr;
+}
+
+auto find_copies(std::span<char const> old_data, std::span<char const> new_data,
+                 std::span<Chunk const> new_chunks, ChunkIndex const& old_index) noexcept -> std::vector<ChunkCopy> {
+    auto copies = std::vector<ChunkCopy>();
+    // new file before this position is already covered by a copy
+    auto covered = std::uint64_t {};
+    for (auto const& chunk : new_chunks) {
+        if (chunk.pos < covered) {
+            continue;
+        }
+        auto const found = old_index.find(chunk.hash);
+        if (found == nullptr || found->size != chunk.size
+            || ::memcmp(old_data.data() + found->pos, new_data.data() + chunk.pos, chunk.size) != 0) {
+            continue;
+        }
+        // runs of unchanged chunks end up as one copy, edges of changed chunks that still agree join too
+        auto const forward = std::mismatch(new_data.data() + chunk.pos + chunk.size, new_data.data() + new_data.size(),
+                                           old_data.data() + found->pos + chunk.size, old_data.data() + old_data.size());
+        auto const end = static_cast<std::uint64_t>(forward.first - new_data.data());
+        auto const back_max = std::min(chunk.pos - covered, found->pos);
+        auto back = std::uint64_t {};
+        while (back != back_max && new_data[chunk.pos - back - 1] == old_data[found->pos - back - 1]) {
+            ++back;
+        }
+        copies.push_back({ chunk.pos - back, found->pos - back, end - chunk.pos + back });
+        covered = end;
+    }
+    return copies;
+}
+
+// new chunk that also exists in old file
+struct SharedChunk {
+    std::uint64_t new_pos;
+    std::uint64_t size;
+    std::uint64_t old_pos;
+};
+
+// one shared chunk projects the whole segment into the old file along its own diagonal
+struct Projection {
+    std::uint64_t old_pos;
+    std::uint64_t votes;
+};
+
+// old region of at most span_max bytes most projections agree on, projections are sorted and not empty
+static auto densest_span(std::vector<Projection> const& projections, std::uint64_t segment_size,
+                         std::uint64_t span_max) noexcept -> std::pair<std::uint64_t, std::uint64_t> {
+    auto best = std::pair<std::uint64_t, std::uint64_t> {};
+    auto best_votes = std::uint64_t {};
+    auto votes = std::uint64_t {};
+    std::size_t first = 0;
+    for (std::size_t last = 0; last != projections.size(); ++last) {
+        votes += projections[last].votes;
+        while (projections[last].old_pos + segment_size - projections[first].old_pos > span_max && first != last) {
+            votes -= projections[first].votes;
+            ++first;
+        }
+        if (votes > best_votes) {
+            best_votes = votes;
+            best = { projections[first].old_pos,
+                     std::min(projections[last].old_pos + segment_size, projections[first].old_pos + span_max) };
+        }
+    }
+    return best;
+}
+
+auto plan_windows(std::span<Chunk const> new_chunks, ChunkIndex const& old_index,
+                  std::uint64_t new_size, std::uint64_t old_size,
+                  std::uint64_t segment_size, std::uint64_t window_max) noexcept -> std::vector<SegmentWindow> {
+    auto shared = std::vector<SharedChunk>();
+    for (auto const& chunk : new_chunks) {
+        if (auto const found = old_index.find(chunk.hash)) {
+            shared.push_back({ chunk.pos, chunk.size, found->pos });
+        }
+    }
+    auto const diagonal = [] (SharedChunk const& chunk, std::uint64_t new_pos) noexcept {
+        return chunk.old_pos + new_pos > chunk.new_pos ? chunk.old_pos + new_pos - chunk.new_pos : 0;
+    };
+    // slack around the projected segment catches insertions and deletions inside it
+    auto const margin = std::min(segment_size, window_max) / 8;
+    auto const span_max = window_max - 2 * margin;
+    auto windows = std::vector<SegmentWindow>();
+    auto projections = std::vector<Projection>();
+    auto next = shared.begin();
+    for (auto new_pos = std::uint64_t {}; new_pos < new_size || windows.empty(); new_pos += segment_size) {
+        auto const new_end = std::min(new_pos + segment_size, new_size);
+        auto window = SegmentWindow { new_pos, new_end - new_pos, 0, old_size };
+        projections.clear();
+        for (; next != shared.end() && next->new_pos < new_end; ++next) {
+            projections.push_back({ diagonal(*next, new_pos), next->size });
+        }
+        if (projections.empty() && !shared.empty()) {
+            // nothing shared inside, follow the closest shared chunk before or after
+            auto const closest = next == shared.begin() ? next
+                : next == shared.end() || new_pos - std::prev(next)->new_pos <= next->new_pos - new_end ? std::prev(next)
+                : next;
+            projections.push_back({ diagonal(*closest, new_pos), 1 });
+        }
+        if (old_size <= window_max) {
+            // whole old file fits, nothing to choose
+            windows.push_back(window);
+            continue;
+        }
+        auto span = std::pair<std::uint64_t, std::uint64_t> {};
+        if (!projections.empty()) {
+            std::sort(projections.begin(), projections.end(), [] (Projection const& lhs, Projection const& rhs) {
+                return lhs.old_pos < rhs.old_pos;
+            });
+            span = densest_span(projections, window.new_size, span_max);
+        } else {
+            // nothing shared at all, old region at the same relative position
+            auto const old_pos = static_cast<std::uint64_t>(
+                static_cast<double>(new_pos) / static_cast<double>(std::max(new_size, std::uint64_t { 1 }))
+                * static_cast<double>(old_size));
+            span = { old_pos, old_pos + window.new_size };
+        }
+        // projections near the end of old file get shifted back so the window stays full size
+        window.old_size = std::min(span.second - span.first + 2 * margin, old_size);
+        window.old_pos = std::min(span.first > margin ? span.first - margin : 0, old_size - window.old_size);
+        windows.push_back(window);
+    }
+    return windows;
+}
+
+auto FingerprintIndex::build(std::span<char const> data, unsigned threads) noexcept -> FingerprintIndex {
+    auto index = FingerprintIndex {};
+    index.data_ = data;
+    auto const section_count = std::clamp(data.size() / section_size_min, std::size_t { 1 },
+                                          std::size_t { std::max(threads, 1u) });
+    auto const section_size = data.size() / section_count;
+    auto sections = std::vector<std::vector<Fingerprint>>(section_count);
+    auto workers = std::vector<std::thread>();
+    for (std::size_t i = 0; i != section_count; ++i) {
+        auto const pos = i * section_size;
+        auto const end = i + 1 == section_count ? data.size() : pos + section_size;
+        workers.emplace_back([&, pos, end, i] () noexcept {
+            // hash starts early enough to agree with serial at the section start
+            auto hash = std::uint64_t {};
+            for (auto scan = pos - std::min(pos, gear_span); scan != end; ++scan) {
+                hash = (hash << 1) + gear_table[static_cast<unsigned char>(data[scan])];
+                if (scan >= pos && scan + 1 >= gear_span && (hash & fingerprint_mask) == 0) {
+                    sections[i].push_back({ hash, scan });
+                }
+            }
+        });
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    for (auto const& section : sections) {
+        index.sorted_.insert(index.sorted_.end(), section.begin(), section.end());
+    }
+    std::stable_sort(index.sorted_.begin(), index.sorted_.end(), [] (Fingerprint const& lhs, Fingerprint const& rhs) {
+        return lhs.hash < rhs.hash;
+    });
+    return index;
+}
+
+auto FingerprintIndex::cover(std::span<char const> window, std::vector<char>& novel) const noexcept -> WindowCover {
+    auto const old = this->data_;
+    auto result = WindowCover { 0, 0, old.size(), 0 };
+    // window before this position is already covered by a match
+    auto covered = std::size_t {};
+    auto hash = std::uint64_t {};
+    for (std::size_t scan = 0; scan != window.size(); ++scan) {
+        hash = (hash << 1) + gear_table[static_cast<unsigned char>(window[scan])];
+        if (scan < covered || scan + 1 < gear_span || (hash & fingerprint_mask) != 0) {
+            continue;
+        }
+        auto const it = std::lower_bound(this->sorted_.begin(), this->sorted_.end(), hash,
+                                         [] (Fingerprint const& fingerprint, std::uint64_t value) {
+            return fingerprint.hash < value;
+        });
+        if (it == this->sorted_.end() || it->hash != hash) {
+            continue;
+        }
+        auto const forward = std::mismatch(window.begin() + static_cast<std::ptrdiff_t>(scan), window.end(),
+                                           old.begin() + static_cast<std::ptrdiff_t>(it->pos), old.end());
+        auto const end = static_cast<std::size_t>(forward.first - window.begin());
+        auto const back_max = std::min(scan - covered, static_cast<std::size_t>(it->pos));
+        auto back = std::size_t {};
+        while (back != back_max && window[scan - back - 1] == old[it->pos - back - 1]) {
+            ++back;
+        }
+        if (end - scan + back < gear_span) {
+            continue;
+        }
+        novel.insert(novel.end(), window.begin() + static_cast<std::ptrdiff_t>(covered),
+                     window.begin() + static_cast<std::ptrdiff_t>(scan - back));
+        result.covered_size += end - scan + back;
+        ++result.match_count;
+        result.old_begin = std::min(result.old_begin, it->pos - back);
+        result.old_end = std::max(result.old_end, it->pos + (end - scan));
+        covered = end;
+    }
+    novel.insert(novel.end(), window.begin() + static_cast<std::ptrdiff_t>(covered), window.end());
+    return result;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Content defined chunk, boundaries follow the content so they survive insertions and deletions.
+struct Chunk {
+    std::uint64_t pos;
+    std::uint64_t size;
+    std::uint64_t hash;
+};
+
+// Splits data into chunks of 16KB to 256KB, 64KB on average.
+// Sections are chunked on separate threads, boundaries only differ from serial right after section starts.
+[[nodiscard]] auto chunk_data(std::span<char const> data, unsigned threads) noexcept -> std::vector<Chunk>;
+
+// Old file chunks by hash, duplicates resolve to the first occurrence.
+struct ChunkIndex {
+    explicit ChunkIndex(std::span<Chunk const> chunks) noexcept;
+
+    [[nodiscard]] auto find(std::uint64_t hash) const noexcept -> Chunk const*;
+
+private:
+    std::vector<Chunk> sorted_ = {};
+};
+
+// Range of new file that is identical to a range of old file.
+struct ChunkCopy {
+    std::uint64_t new_pos;
+    std::uint64_t old_pos;
+    std::uint64_t size;
+};
+
+// Identical ranges found through shared chunks, verified bytewise and grown over neighbouring bytes that agree too.
+// Sorted by new position and never overlapping.
+[[nodiscard]] auto find_copies(std::span<char const> old_data, std::span<char const> new_data,
+                               std::span<Chunk const> new_chunks, ChunkIndex const& old_index) noexcept -> std::vector<ChunkCopy>;
+
+// Region of the old file that serves as dictionary for one segment of the new file.
+struct SegmentWindow {
+    std::uint64_t new_pos;
+    std::uint64_t new_size;
+    std::uint64_t old_pos;
+    std::uint64_t old_size;
+};
+
+// Splits new file into segments and picks the old region of at most window_max bytes
+// that covers most of the chunks each segment shares with the old file.
+// Segments without any shared chunk get the old region at the same relative position.
+[[nodiscard]] auto plan_windows(std::span<Chunk const> new_chunks, ChunkIndex const& old_index,
+                                std::uint64_t new_size, std::uint64_t old_size,
+                                std::uint64_t segment_size, std::uint64_t window_max) noexcept -> std::vector<SegmentWindow>;
+
+// Bytes of a window of new file found in old file through the fingerprint index.
+struct WindowCover {
+    std::uint64_t covered_size;
+    std::uint64_t match_count;
+    // range of old file the matches came from, empty without any
+    std::uint64_t old_begin;
+    std::uint64_t old_end;
+};
+
+// Sparse fingerprints of old file, the gear hash over the last 64 bytes wherever its top bits are clear,
+// about one per 128 bytes. Sections are indexed on separate threads, same as serial.
+struct FingerprintIndex {
+    [[nodiscard]] static auto build(std::span<char const> data, unsigned threads) noexcept -> FingerprintIndex;
+
+    // Matches of window against old file through shared fingerprints, verified bytewise and grown over
+    // neighbouring bytes that agree too. Bytes outside of every match are appended to novel.
+    [[nodiscard]] auto cover(std::span<char const> window, std::vector<char>& novel) const noexcept -> WindowCover;
+
+private:
+    struct Fingerprint {
+        std::uint64_t hash;
+        std::uint64_t pos;
+    };
+
+    std::span<char const> data_ = {};
+    std::vector<Fingerprint> sorted_ = {};
+};
@@ -0,0 +1,44 @@
+#include "dict_index.hpp"
+#include <string.h>
+#include "common/xxhash.h"
+
+constexpr char dict_index_magic[8] = { 'Z', 'S', 'T', 'D', 'I', 'D', 'X', '2' };
+
+auto dict_index_hash(std::span<char const> old_data) noexcept -> std::uint64_t {
+    return XXH64(old_data.data(), old_data.size(), 0);
+}
+
+auto dict_index_header(std::uint64_t old_size, std::uint64_t old_hash,
+                       ZSTD_compressionParameters const& cparams,
+                       std::span<char const> tables) noexcept -> DictIndexHeader {
+    auto header = DictIndexHeader {};
+    ::memcpy(header.magic, dict_index_magic, sizeof(header.magic));
+    header.old_size = old_size;
+    header.old_hash = old_hash;
+    header.tables_size = tables.size();
+    header.tables_hash = XXH64(tables.data(), tables.size(), 0);
+    header.cparams = cparams;
+    return header;
+}
+
+auto dict_index_tables(std::span<char const> index,
+                       std::uint64_t old_size, std::uint64_t old_hash,
+                       ZSTD_compressionParameters const& cparams) noexcept -> std::span<char const> {
+    if (index.size() < dict_index_tables_offset) {
+        return {};
+    }
+    auto header = DictIndexHeader {};
+    ::memcpy(&header, index.data(), sizeof(header));
+    if (::memcmp(header.magic, dict_index_magic, sizeof(header.magic)) != 0
+        || header.old_size != old_size
+        || header.old_hash != old_hash
+        || header.tables_size != index.size() - dict_index_tables_offset
+        || ::memcmp(&header.cparams, &cparams, sizeof(cparams)) != 0) {
+        return {};
+    }
+    auto const tables = index.subspan(dict_index_tables_offset);
+    if (XXH64(tables.data(), tables.size(), 0) != header.tables_hash) {
+        return {};
+    }
+    return tables;
+}
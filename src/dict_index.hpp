@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "zstd.h"
+
+// Sidecar file holding the loaded tables of a dictionary over the old file.
+// Layout: DictIndexHeader, padding, tables written by ZSTD_CDict_saveTables.
+struct DictIndexHeader {
+    char magic[8];
+    std::uint64_t old_size;
+    std::uint64_t old_hash;
+    std::uint64_t tables_size;
+    // zstd takes match positions in the tables as they are, a damaged one would read outside of old file
+    std::uint64_t tables_hash;
+    ZSTD_compressionParameters cparams;
+};
+
+// tables start aligned for zstd, which references them straight from the mapping
+constexpr std::size_t dict_index_tables_offset = 128;
+static_assert(sizeof(DictIndexHeader) <= dict_index_tables_offset);
+
+// Identifies the content an index was built from.
+[[nodiscard]] auto dict_index_hash(std::span<char const> old_data) noexcept -> std::uint64_t;
+
+[[nodiscard]] auto dict_index_header(std::uint64_t old_size, std::uint64_t old_hash,
+                                     ZSTD_compressionParameters const& cparams,
+                                     std::span<char const> tables) noexcept -> DictIndexHeader;
+
+// Tables part of a mapped index, empty when it was built for other content or parameters or its tables changed.
+[[nodiscard]] auto dict_index_tables(std::span<char const> index,
+                                     std::uint64_t old_size, std::uint64_t old_hash,
+                                     ZSTD_compressionParameters const& cparams) noexcept -> std::span<char const>;
@@ -2,6 +2,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <algorithm>
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -110,8 +112,32 @@ auto MMapRaw::close_on_error(char const* header) noexcept -> MMapError {
     return error;
 }
 
+auto advise_access(std::span<char const> data, MMapAccess access) noexcept -> void {
+    if (data.empty()) {
+        return;
+    }
+#ifdef _WIN32
+    // only reading ahead has a counterpart, patterns are left to the cache manager
+    if (access == MMapAccess::willneed) {
+        auto range = WIN32_MEMORY_RANGE_ENTRY { const_cast<char*>(data.data()), data.size() };
+        ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+    }
+#else
+    // advice goes by whole pages, the ones data starts and ends in included
+    static auto const page_size = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+    auto const begin = reinterpret_cast<std::uintptr_t>(data.data()) & ~(page_size - 1);
+    auto const end = reinterpret_cast<std::uintptr_t>(data.data() + data.size());
+    auto const advice = access == MMapAccess::sequential ? MADV_SEQUENTIAL
+        : access == MMapAccess::random ? MADV_RANDOM
+        : access == MMapAccess::willneed ? MADV_WILLNEED
+        : MADV_NORMAL;
+    // only a hint, failing changes nothing
+    ::madvise(reinterpret_cast<void*>(begin), end - begin, advice);
+#endif
+}
+
 auto MMapRaw::open_raw(std::filesystem::path const& path, bool read_only,
-                       std::optional<std::size_t> create_size) noexcept -> MMapError {
+                       std::optional<std::size_t> create_size, MMapOptions const& options) noexcept -> MMapError {
     if (auto error = this->close_raw()) {
         return error;
     }
@@ -170,6 +196,14 @@ auto MMapRaw::open_raw(std::filesystem::path const& path, bool read_only,
         return this->close_on_error("map view");
     }
     this->map_data_ = raw_data;
+    // no huge pages for views of files
+    if (options.populate) {
+        auto range = WIN32_MEMORY_RANGE_ENTRY { raw_data, this->file_size_ };
+        ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+    }
+    if (options.lock && ::VirtualLock(raw_data, this->file_size_) == FALSE) {
+        return this->close_on_error("lock pages");
+    }
     return {};
 #else
     auto const raw_file_hadle = [&] {
@@ -203,20 +237,130 @@ auto MMapRaw::open_raw(std::filesystem::path const& path, bool read_only,
     }
     this->file_size_ = static_cast<std::size_t>(raw_stat.st_size);
 
+    auto map_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (options.populate) {
+        map_flags |= MAP_POPULATE;
+    }
+#endif
     auto const raw_data = ::mmap(nullptr,
                                  raw_stat.st_size,
                                  read_only ? PROT_READ : PROT_WRITE,
-                                 MAP_SHARED,
+                                 map_flags,
                                  raw_file_hadle,
                                  0);
     if (raw_data == MAP_FAILED) {
         return this->close_on_error("map view");
     }
     this->map_data_ = raw_data;
+#ifdef MADV_HUGEPAGE
+    // kernels without huge pages for files refuse it, the mapping just keeps normal pages then
+    if (options.huge_pages) {
+        ::madvise(raw_data, this->file_size_, MADV_HUGEPAGE);
+    }
+#endif
+#ifndef MAP_POPULATE
+    if (options.populate) {
+        ::madvise(raw_data, this->file_size_, MADV_WILLNEED);
+    }
+#endif
+    if (options.lock && ::mlock(raw_data, this->file_size_) != 0) {
+        return this->close_on_error("lock pages");
+    }
     return {};
 #endif
 }
 
+// files grow by at least this much, whatever the size they start from
+constexpr std::size_t grow_step_min = std::size_t { 16 } << 20;
+
+auto MMapRaw::grow_raw(std::size_t size) noexcept -> MMapError {
+    if (size <= this->file_size_) {
+        return {};
+    }
+    auto const new_size = std::max({ size, this->file_size_ + std::max(this->file_size_, grow_step_min) });
+#ifdef _WIN32
+    // views cannot outgrow their mapping object, both get made over for the new size
+    if (this->map_data_ != nullptr) {
+        if (::UnmapViewOfFile(this->map_data_) == FALSE) {
+            return this->close_on_error("Unmap file view");
+        }
+        this->map_data_ = nullptr;
+    }
+    if (this->map_handle_ != 0) {
+        if (::CloseHandle(reinterpret_cast<HANDLE>(this->map_handle_)) == FALSE) {
+            return this->close_on_error("Close map handle");
+        }
+        this->map_handle_ = 0;
+    }
+    auto const raw_file_handle = reinterpret_cast<HANDLE>(this->file_handle_);
+    auto raw_file_size = LARGE_INTEGER {};
+    raw_file_size.QuadPart = static_cast<LONGLONG>(new_size);
+    if (::SetFilePointerEx(raw_file_handle, raw_file_size, nullptr, FILE_BEGIN) == FALSE) {
+        return this->close_on_error("grow file size");
+    }
+    if (::SetEndOfFile(raw_file_handle) == FALSE) {
+        return this->close_on_error("grow file end");
+    }
+    if (::SetFilePointerEx(raw_file_handle, { .QuadPart = 0 }, nullptr, FILE_BEGIN) == FALSE) {
+        return this->close_on_error("grow file begin");
+    }
+    auto const raw_map_handle = ::CreateFileMapping(raw_file_handle,
+                                                    0,
+                                                    PAGE_READWRITE,
+                                                    raw_file_size.HighPart,
+                                                    raw_file_size.LowPart,
+                                                    0);
+    if (raw_map_handle == INVALID_HANDLE_VALUE || raw_map_handle == nullptr) {
+        return this->close_on_error("open map handle");
+    }
+    this->map_handle_ = reinterpret_cast<std::intptr_t>(raw_map_handle);
+    auto const raw_data = ::MapViewOfFile(raw_map_handle, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, new_size);
+    if (raw_data == nullptr) {
+        return this->close_on_error("map view");
+    }
+    this->map_data_ = raw_data;
+    this->file_size_ = new_size;
+#else
+    auto const raw_file_handle = static_cast<int>(this->file_handle_);
+    auto const grow_size = static_cast<off_t>(new_size - this->file_size_);
+#ifdef __linux__
+    // blocks get allocated up front, a full disk fails here instead of as SIGBUS on a write into the mapping,
+    // file systems that cannot allocate ahead just get a sparse file
+    if (::fallocate(raw_file_handle, 0, static_cast<off_t>(this->file_size_), grow_size) != 0
+        && (errno != EOPNOTSUPP || ::ftruncate(raw_file_handle, static_cast<off_t>(new_size)) != 0)) {
+        return MMapError::with_header("grow file size");
+    }
+#else
+    if (::ftruncate(raw_file_handle, static_cast<off_t>(new_size)) != 0) {
+        return MMapError::with_header("grow file size");
+    }
+#endif
+    // mapping stays as it was on failure, the file past it gets cut off on close
+#ifdef MREMAP_MAYMOVE
+    auto const raw_data = this->map_data_ != nullptr
+        ? ::mremap(this->map_data_, this->file_size_, new_size, MREMAP_MAYMOVE)
+        : ::mmap(nullptr, new_size, PROT_WRITE, MAP_SHARED, raw_file_handle, 0);
+    if (raw_data == MAP_FAILED) {
+        return MMapError::with_header("remap view");
+    }
+#else
+    auto const raw_data = ::mmap(nullptr, new_size, PROT_WRITE, MAP_SHARED, raw_file_handle, 0);
+    if (raw_data == MAP_FAILED) {
+        return MMapError::with_header("remap view");
+    }
+    if (this->map_data_ != nullptr && ::munmap(this->map_data_, this->file_size_) != 0) {
+        auto error = MMapError::with_header("unmap file view");
+        ::munmap(raw_data, new_size);
+        return error;
+    }
+#endif
+    this->map_data_ = raw_data;
+    this->file_size_ = new_size;
+#endif
+    return {};
+}
+
 auto MMapRaw::sync_raw() noexcept -> void {
 #ifdef _WIN32
     if (this->map_data_ != nullptr) {
@@ -232,3 +376,241 @@ auto MMapRaw::sync_raw() noexcept -> void {
     }
 #endif
 }
+
+// windows start at multiples of this, whatever lies before pos in its first page gets mapped as well
+static auto map_granularity() noexcept -> std::uint64_t {
+#ifdef _WIN32
+    static auto const granularity = [] {
+        auto info = SYSTEM_INFO {};
+        ::GetSystemInfo(&info);
+        return static_cast<std::uint64_t>(info.dwAllocationGranularity);
+    } ();
+#else
+    static auto const granularity = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+#endif
+    return granularity;
+}
+
+auto MMapWindowRaw::unmap_raw() noexcept -> MMapError {
+    if (this->map_data_ == nullptr) {
+        return {};
+    }
+    // written pages stay in the page cache, they reach the file on sync or close
+#ifdef _WIN32
+    if (::UnmapViewOfFile(this->map_data_) == FALSE) {
+        return MMapError::with_header("Unmap file view");
+    }
+#else
+    if (::munmap(this->map_data_, this->map_size_) != 0) {
+        return MMapError::with_header("unmap file view");
+    }
+#endif
+    this->map_data_ = nullptr;
+    this->map_pos_ = 0;
+    this->map_size_ = 0;
+    return {};
+}
+
+auto MMapWindowRaw::close_raw(std::optional<std::uint64_t> trunc_size) noexcept -> MMapError {
+    if (this->file_handle_ == 0) {
+        return {};
+    }
+    if (!this->read_only_) {
+        this->sync_raw();
+    }
+    if (auto error = this->unmap_raw()) {
+        return error;
+    }
+#ifdef _WIN32
+    if (this->map_handle_ != 0) {
+        if (::CloseHandle(reinterpret_cast<HANDLE>(this->map_handle_)) == FALSE) {
+            return MMapError::with_header("Close map handle");
+        }
+        this->map_handle_ = 0;
+    }
+    auto const raw_file_handle = reinterpret_cast<HANDLE>(this->file_handle_);
+    if (trunc_size && this->file_size_ != *trunc_size) {
+        auto const new_file_size = LARGE_INTEGER { .QuadPart = static_cast<LONGLONG>(*trunc_size) };
+        if (::SetFilePointerEx(raw_file_handle, new_file_size, nullptr, FILE_BEGIN) == FALSE) {
+            return MMapError::with_header("Trunc set size");
+        }
+        if (::SetEndOfFile(raw_file_handle) == FALSE) {
+            return MMapError::with_header("Trunc set end");
+        }
+        this->file_size_ = *trunc_size;
+    }
+    if (::CloseHandle(raw_file_handle) == FALSE) {
+        return MMapError::with_header("Close file handle");
+    }
+#else
+    auto const raw_file_handle = static_cast<int>(this->file_handle_);
+    if (trunc_size && this->file_size_ != *trunc_size) {
+        if (::ftruncate(raw_file_handle, static_cast<off_t>(*trunc_size)) != 0) {
+            return MMapError::with_header("trunc set size");
+        }
+        this->file_size_ = *trunc_size;
+    }
+    if (::close(raw_file_handle) != 0) {
+        return MMapError::with_header("close file handle");
+    }
+#endif
+    this->file_handle_ = 0;
+    this->file_size_ = 0;
+    return {};
+}
+
+auto MMapWindowRaw::close_or_panic() noexcept -> void {
+    if (auto error = this->close_raw()) {
+        ::fprintf(stderr, "Failed to close at %s because %d(%s)\n",
+                  error.header, error.errnum, ::strerror(error.errnum));
+        ::exit(EXIT_FAILURE);
+    }
+}
+
+auto MMapWindowRaw::close_on_error(char const* header) noexcept -> MMapError {
+    auto error = MMapError::with_header(header);
+    this->close_or_panic();
+    return error;
+}
+
+auto MMapWindowRaw::open_raw(std::filesystem::path const& path, bool read_only, std::size_t window_size,
+                             std::optional<std::uint64_t> create_size) noexcept -> MMapError {
+    if (auto error = this->close_raw()) {
+        return error;
+    }
+    this->read_only_ = read_only;
+    // rounded up to whole pages, views never fail for being just below window size
+    auto const granularity = map_granularity();
+    this->window_size_ = static_cast<std::size_t>((std::max(window_size, std::size_t { 1 }) + granularity - 1)
+                                                  & ~(granularity - 1));
+#ifdef _WIN32
+    auto const raw_file_handle = ::CreateFile(path.string().c_str(),
+                                              read_only ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+                                              FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                              0,
+                                              create_size ? OPEN_ALWAYS : OPEN_EXISTING,
+                                              FILE_ATTRIBUTE_NORMAL,
+                                              0);
+    if (raw_file_handle == INVALID_HANDLE_VALUE || raw_file_handle == nullptr) {
+        return this->close_on_error("open file handle");
+    }
+    this->file_handle_ = reinterpret_cast<std::intptr_t>(raw_file_handle);
+
+    auto raw_file_size = LARGE_INTEGER{};
+    if (create_size) {
+        raw_file_size.QuadPart = static_cast<LONGLONG>(*create_size);
+        if (::SetFilePointerEx(raw_file_handle, raw_file_size, nullptr, FILE_BEGIN) == FALSE) {
+            return this->close_on_error("set file size");
+        }
+        if (::SetEndOfFile(raw_file_handle) == FALSE) {
+            return this->close_on_error("set file end");
+        }
+    } else {
+        if (::GetFileSizeEx(raw_file_handle, &raw_file_size) == 0) {
+            return this->close_on_error("get file size");
+        }
+    }
+    this->file_size_ = static_cast<std::uint64_t>(raw_file_size.QuadPart);
+    if (this->file_size_ == 0) {
+        return {};
+    }
+    // the mapping object spans the whole file without taking address space, only views do
+    auto const raw_map_handle = ::CreateFileMapping(raw_file_handle,
+                                                    0,
+                                                    read_only ? PAGE_READONLY : PAGE_READWRITE,
+                                                    raw_file_size.HighPart,
+                                                    raw_file_size.LowPart,
+                                                    0);
+    if (raw_map_handle == INVALID_HANDLE_VALUE || raw_map_handle == nullptr) {
+        return this->close_on_error("open map handle");
+    }
+    this->map_handle_ = reinterpret_cast<std::intptr_t>(raw_map_handle);
+#else
+    auto const raw_file_handle = create_size
+        ? ::open(path.string().c_str(), (read_only ? O_RDONLY : O_RDWR) | O_CREAT, 0644)
+        : ::open(path.string().c_str(), read_only ? O_RDONLY : O_RDWR);
+    if (raw_file_handle == -1) {
+        return this->close_on_error("open file handle");
+    }
+    this->file_handle_ = static_cast<std::intptr_t>(raw_file_handle);
+
+    struct ::stat raw_stat = {};
+    if (create_size) {
+        raw_stat.st_size = static_cast<off_t>(*create_size);
+        if (::ftruncate(raw_file_handle, raw_stat.st_size) != 0) {
+            return this->close_on_error("set file size");
+        }
+    } else {
+        if (::fstat(raw_file_handle, &raw_stat) != 0) {
+            return this->close_on_error("get file size");
+        }
+    }
+    this->file_size_ = static_cast<std::uint64_t>(raw_stat.st_size);
+#endif
+    return {};
+}
+
+auto MMapWindowRaw::view_raw(std::uint64_t pos, std::size_t size, void*& data) noexcept -> MMapError {
+    if (size > this->window_size_ || pos > this->file_size_ || size > this->file_size_ - pos) {
+        return { "view outside of window or file", EINVAL };
+    }
+    if (this->map_data_ != nullptr && pos >= this->map_pos_ && pos + size <= this->map_pos_ + this->map_size_) {
+        data = static_cast<char*>(this->map_data_) + (pos - this->map_pos_);
+        return {};
+    }
+    if (auto error = this->unmap_raw()) {
+        return error;
+    }
+    if (size == 0) {
+        data = nullptr;
+        return {};
+    }
+    // window starts at the page pos is in and reaches a window past pos, or to the end of the file
+    auto const map_pos = pos & ~(map_granularity() - 1);
+    auto const map_size = static_cast<std::size_t>(std::min(this->file_size_ - map_pos,
+                                                            pos - map_pos + this->window_size_));
+#ifdef _WIN32
+    auto const raw_data = ::MapViewOfFile(reinterpret_cast<HANDLE>(this->map_handle_),
+                                          this->read_only_ ? FILE_MAP_READ : FILE_MAP_READ | FILE_MAP_WRITE,
+                                          static_cast<DWORD>(map_pos >> 32),
+                                          static_cast<DWORD>(map_pos),
+                                          map_size);
+    if (raw_data == nullptr) {
+        return MMapError::with_header("map view");
+    }
+#else
+    auto const raw_data = ::mmap(nullptr,
+                                 map_size,
+                                 this->read_only_ ? PROT_READ : PROT_READ | PROT_WRITE,
+                                 MAP_SHARED,
+                                 static_cast<int>(this->file_handle_),
+                                 static_cast<off_t>(map_pos));
+    if (raw_data == MAP_FAILED) {
+        return MMapError::with_header("map view");
+    }
+#endif
+    this->map_data_ = raw_data;
+    this->map_pos_ = map_pos;
+    this->map_size_ = map_size;
+    advise_access({ static_cast<char const*>(raw_data), map_size }, MMapAccess::sequential);
+    data = static_cast<char*>(raw_data) + (pos - map_pos);
+    return {};
+}
+
+auto MMapWindowRaw::sync_raw() noexcept -> void {
+#ifdef _WIN32
+    if (this->map_data_ != nullptr) {
+        ::FlushViewOfFile(this->map_data_, this->map_size_);
+    }
+    if (this->file_handle_ != 0) {
+        ::FlushFileBuffers(reinterpret_cast<HANDLE>(this->file_handle_));
+    }
+#else
+    if (this->map_data_ != nullptr) {
+        ::msync(this->map_data_, this->map_size_, MS_SYNC);
+    }
+    if (this->file_handle_ != 0) {
+        ::fsync(static_cast<int>(this->file_handle_));
+    }
+#endif
+}
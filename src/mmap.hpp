@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <filesystem>
 #include <optional>
 #include <span>
@@ -18,6 +19,28 @@ struct MMapError {
     }
 };
 
+// How a mapping gets read from here on, the kernel tunes readahead to it.
+enum class MMapAccess : std::uint32_t {
+    normal = 0,
+    sequential = 1,
+    random = 2,
+    // not a pattern, starts reading all of it in the background
+    willneed = 3,
+};
+
+// Applies to the whole mapping for as long as it is open.
+struct MMapOptions {
+    // every page gets read in right away instead of on first access
+    bool populate = false;
+    // pages stay in memory, open fails when the memlock limit does not allow that
+    bool lock = false;
+    // transparent huge pages where the kernel supports them for file mappings, fewer TLB misses
+    bool huge_pages = false;
+};
+
+// Hint for the pages data spans, any memory is fine but only mappings of files make use of it.
+auto advise_access(std::span<char const> data, MMapAccess access) noexcept -> void;
+
 struct MMapRaw {
 protected:
     std::intptr_t file_handle_ = {};
@@ -26,8 +49,10 @@ protected:
     void* map_data_ = {};
 
     [[nodiscard]] auto open_raw(std::filesystem::path const& path, bool read_only,
-                                std::optional<std::size_t> create_size = {}) noexcept -> MMapError;
+                                std::optional<std::size_t> create_size = {},
+                                MMapOptions const& options = {}) noexcept -> MMapError;
     [[nodiscard]] auto close_raw(std::optional<std::size_t> trunc_size = {}) noexcept -> MMapError;
+    [[nodiscard]] auto grow_raw(std::size_t size) noexcept -> MMapError;
     auto close_or_panic() noexcept -> void;
     auto sync_raw() noexcept -> void;
 
@@ -55,6 +80,10 @@ struct MMap : private MMapRaw {
     [[nodiscard]] inline auto open(std::filesystem::path const& path) noexcept -> MMapError {
         return this->open_raw(path, std::is_const_v<CharType>);
     }
+    [[nodiscard]] inline auto open(std::filesystem::path const& path,
+                                   MMapOptions const& options) noexcept -> MMapError {
+        return this->open_raw(path, std::is_const_v<CharType>, {}, options);
+    }
     [[nodiscard]] inline auto create(std::filesystem::path const& path,
                                      std::size_t size) noexcept -> MMapError requires (!std::is_const_v<CharType>) {
         return this->open_raw(path, std::is_const_v<CharType>, size);
@@ -68,6 +97,11 @@ struct MMap : private MMapRaw {
     [[nodiscard]] inline auto close(std::size_t size) noexcept -> MMapError requires (!std::is_const_v<CharType>) {
         return this->close_raw(size);
     }
+    // file and mapping grow to at least size elements, in geometric steps so growing a little at a time stays
+    // cheap, data can move, close with the size actually used cuts off what is left over
+    [[nodiscard]] inline auto grow(std::size_t size) noexcept -> MMapError requires (!std::is_const_v<CharType>) {
+        return this->grow_raw(size * sizeof(CharType));
+    }
 
     [[nodiscard]] inline auto data() const noexcept -> CharType* {
         return reinterpret_cast<CharType*>(this->map_data_);
@@ -86,3 +120,91 @@ struct MMap : private MMapRaw {
         return this->file_handle_ == 0;
     }
 };
+
+struct MMapWindowRaw {
+protected:
+    std::intptr_t file_handle_ = {};
+    std::uint64_t file_size_ = {};
+    std::intptr_t map_handle_ = {};
+    void* map_data_ = {};
+    std::uint64_t map_pos_ = {};
+    std::size_t map_size_ = {};
+    std::size_t window_size_ = {};
+    bool read_only_ = {};
+
+    [[nodiscard]] auto open_raw(std::filesystem::path const& path, bool read_only, std::size_t window_size,
+                                std::optional<std::uint64_t> create_size = {}) noexcept -> MMapError;
+    [[nodiscard]] auto close_raw(std::optional<std::uint64_t> trunc_size = {}) noexcept -> MMapError;
+    auto close_or_panic() noexcept -> void;
+    auto sync_raw() noexcept -> void;
+    [[nodiscard]] auto view_raw(std::uint64_t pos, std::size_t size, void*& data) noexcept -> MMapError;
+
+private:
+    [[nodiscard]] auto unmap_raw() noexcept -> MMapError;
+    [[nodiscard]] auto close_on_error(char const* header) noexcept -> MMapError;
+};
+
+// Maps at most window size bytes of a file at a time, the mapping moves along to whatever range gets viewed.
+// Address space stays bounded however large the file is, for 32bit targets and containers with tight VM limits.
+// Views are meant to move forward, every mapping gets read ahead sequentially.
+template <typename CharType>
+struct MMapWindow : private MMapWindowRaw {
+    [[nodiscard]] inline MMapWindow() noexcept = default;
+    inline MMapWindow(MMapWindow const& other) = delete;
+    [[nodiscard]] inline MMapWindow(MMapWindow&& other) noexcept {
+        std::swap(static_cast<MMapWindowRaw&>(*this), static_cast<MMapWindowRaw&>(other));
+    }
+    inline MMapWindow& operator=(MMapWindow const& other) = delete;
+    inline MMapWindow& operator=(MMapWindow&& other) noexcept {
+        MMapWindow tmp = static_cast<MMapWindow&&>(other);
+        std::swap(static_cast<MMapWindowRaw&>(*this), static_cast<MMapWindowRaw&>(tmp));
+        return *this;
+    }
+    inline ~MMapWindow() noexcept {
+        this->close_or_panic();
+    }
+
+    [[nodiscard]] inline auto open(std::filesystem::path const& path, std::size_t window_size) noexcept -> MMapError {
+        return this->open_raw(path, std::is_const_v<CharType>, window_size);
+    }
+    [[nodiscard]] inline auto create(std::filesystem::path const& path, std::uint64_t size,
+                                     std::size_t window_size) noexcept -> MMapError
+            requires (!std::is_const_v<CharType>) {
+        return this->open_raw(path, std::is_const_v<CharType>, window_size, size);
+    }
+    inline auto sync() noexcept -> void {
+        this->sync_raw();
+    }
+    [[nodiscard]] inline auto close() noexcept -> MMapError {
+        return this->close_raw();
+    }
+    [[nodiscard]] inline auto close(std::uint64_t size) noexcept -> MMapError requires (!std::is_const_v<CharType>) {
+        return this->close_raw(size);
+    }
+
+    // size elements from pos on, remapping when they are not all in the current window,
+    // valid until the next view, size has to fit into the window and the range into the file
+    [[nodiscard]] inline auto view(std::uint64_t pos, std::size_t size,
+                                   std::span<CharType>& out) noexcept -> MMapError {
+        auto data = static_cast<void*>(nullptr);
+        if (auto error = this->view_raw(pos * sizeof(CharType), size * sizeof(CharType), data)) {
+            return error;
+        }
+        out = std::span { reinterpret_cast<CharType*>(data), size };
+        return {};
+    }
+
+    [[nodiscard]] inline auto size() const noexcept -> std::uint64_t {
+        return this->file_size_ / sizeof(CharType);
+    }
+    [[nodiscard]] inline auto window_size() const noexcept -> std::size_t {
+        return this->window_size_ / sizeof(CharType);
+    }
+
+    [[nodiscard]] inline explicit operator bool() const noexcept {
+        return this->file_handle_ != 0;
+    }
+    [[nodiscard]] inline bool operator!() const noexcept {
+        return this->file_handle_ == 0;
+    }
+};
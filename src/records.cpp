@@ -0,0 +1,154 @@
+#include "records.hpp"
+#include "zstd.h"
+
+// each extent is coded as gap to the previous extent, zigzag old position delta and size
+constexpr std::size_t extent_code_size = 24;
+
+static auto store_le(char* dst, std::uint64_t value, std::size_t size) noexcept -> char* {
+    for (std::size_t i = 0; i != size; ++i) {
+        dst[i] = static_cast<char>(value >> (8 * i));
+    }
+    return dst + size;
+}
+
+static auto load_le(char const* src, std::size_t size) noexcept -> std::uint64_t {
+    auto value = std::uint64_t {};
+    for (std::size_t i = 0; i != size; ++i) {
+        value |= std::uint64_t { static_cast<unsigned char>(src[i]) } << (8 * i);
+    }
+    return value;
+}
+
+auto read_record(std::span<char const> src) noexcept -> std::optional<Record> {
+    if (src.size() < record_header_size || load_le(src.data(), 4) != record_magic) {
+        return std::nullopt;
+    }
+    // skippable frame size excludes magic and size fields but includes our kind
+    auto const content_size = load_le(src.data() + 4, 4);
+    if (content_size < 4 || content_size > src.size() - 8) {
+        return std::nullopt;
+    }
+    return Record {
+        static_cast<RecordKind>(load_le(src.data() + 8, 4)),
+        src.subspan(record_header_size, content_size - 4),
+        8 + content_size,
+    };
+}
+
+static auto write_header(char* dst, RecordKind kind, std::size_t payload_size) noexcept -> char* {
+    dst = store_le(dst, record_magic, 4);
+    dst = store_le(dst, 4 + payload_size, 4);
+    return store_le(dst, static_cast<std::uint32_t>(kind), 4);
+}
+
+auto write_dict_window(char* dst, DictWindow const& window) noexcept -> std::size_t {
+    auto out = write_header(dst, RecordKind::dict_window, dict_window_record_size - record_header_size);
+    out = store_le(out, window.old_pos, 8);
+    out = store_le(out, window.old_size, 8);
+    return static_cast<std::size_t>(out - dst);
+}
+
+auto read_dict_window(Record const& record) noexcept -> std::optional<DictWindow> {
+    if (record.kind != RecordKind::dict_window || record.payload.size() != dict_window_record_size - record_header_size) {
+        return std::nullopt;
+    }
+    return DictWindow {
+        load_le(record.payload.data(), 8),
+        load_le(record.payload.data() + 8, 8),
+    };
+}
+
+auto write_branch_filter(char* dst) noexcept -> std::size_t {
+    return static_cast<std::size_t>(write_header(dst, RecordKind::branch_filter, 0) - dst);
+}
+
+auto write_common_affix(char* dst, CommonAffix const& affix) noexcept -> std::size_t {
+    auto out = write_header(dst, RecordKind::common_affix, common_affix_record_size - record_header_size);
+    out = store_le(out, affix.prefix_size, 8);
+    out = store_le(out, affix.suffix_size, 8);
+    return static_cast<std::size_t>(out - dst);
+}
+
+auto read_common_affix(Record const& record) noexcept -> std::optional<CommonAffix> {
+    if (record.kind != RecordKind::common_affix || record.payload.size() != common_affix_record_size - record_header_size) {
+        return std::nullopt;
+    }
+    return CommonAffix {
+        load_le(record.payload.data(), 8),
+        load_le(record.payload.data() + 8, 8),
+    };
+}
+
+static auto zigzag(std::uint64_t value) noexcept -> std::uint64_t {
+    return (value << 1) ^ (0 - (value >> 63));
+}
+
+static auto unzigzag(std::uint64_t value) noexcept -> std::uint64_t {
+    return (value >> 1) ^ (0 - (value & 1));
+}
+
+auto byte_diff_record_bound(std::size_t extent_count) noexcept -> std::size_t {
+    return record_header_size + 8 + ZSTD_compressBound(extent_count * extent_code_size);
+}
+
+auto write_byte_diff(char* dst, std::size_t dst_size, std::span<DiffExtent const> extents) noexcept -> std::size_t {
+    // neighbouring extents mostly follow the same alignment, so the deltas are small and compress well
+    auto codes = std::vector<char>(extents.size() * extent_code_size);
+    auto code = codes.data();
+    auto new_end = std::uint64_t {};
+    auto old_end = std::uint64_t {};
+    for (auto const& extent : extents) {
+        code = store_le(code, extent.new_pos - new_end, 8);
+        code = store_le(code, zigzag(extent.old_pos - old_end), 8);
+        code = store_le(code, extent.size, 8);
+        new_end = extent.new_pos + extent.size;
+        old_end = extent.old_pos + extent.size;
+    }
+    // too small a dst leaves no capacity and zstd reports that
+    auto const packed_capacity = dst_size > record_header_size + 8 ? dst_size - record_header_size - 8 : 0;
+    auto const packed_size = ZSTD_compress(dst + record_header_size + 8, packed_capacity,
+                                           codes.data(), codes.size(), 19);
+    if (ZSTD_isError(packed_size)) {
+        return packed_size;
+    }
+    auto out = write_header(dst, RecordKind::byte_diff, 8 + packed_size);
+    store_le(out, extents.size(), 8);
+    return record_header_size + 8 + packed_size;
+}
+
+auto read_byte_diff(Record const& record, std::uint64_t new_size) noexcept -> std::optional<std::vector<DiffExtent>> {
+    if (record.kind != RecordKind::byte_diff || record.payload.size() < 8) {
+        return std::nullopt;
+    }
+    auto const count = load_le(record.payload.data(), 8);
+    auto const packed = record.payload.subspan(8);
+    // frame header is as untrusted as the count, before anything gets allocated the size has to fit what the
+    // packed bytes can decompress to and extents of at least a byte each have to fit into new file
+    auto const codes_size = ZSTD_getFrameContentSize(packed.data(), packed.size());
+    auto const codes_bound = ZSTD_decompressBound(packed.data(), packed.size());
+    if (codes_size >= ZSTD_CONTENTSIZE_ERROR || codes_bound == ZSTD_CONTENTSIZE_ERROR || codes_size > codes_bound
+        || count != codes_size / extent_code_size || codes_size % extent_code_size != 0 || count > new_size) {
+        return std::nullopt;
+    }
+    auto codes = std::vector<char>(codes_size);
+    if (ZSTD_decompress(codes.data(), codes.size(), packed.data(), packed.size()) != codes.size()) {
+        return std::nullopt;
+    }
+    auto extents = std::vector<DiffExtent>(count);
+    auto code = codes.data();
+    auto new_end = std::uint64_t {};
+    auto old_end = std::uint64_t {};
+    for (auto& extent : extents) {
+        extent.new_pos = new_end + load_le(code, 8);
+        extent.old_pos = old_end + unzigzag(load_le(code + 8, 8));
+        extent.size = load_le(code + 16, 8);
+        code += extent_code_size;
+        // wrapping around would make later extents overlap earlier ones
+        if (extent.new_pos < new_end || extent.new_pos + extent.size < extent.new_pos) {
+            return std::nullopt;
+        }
+        new_end = extent.new_pos + extent.size;
+        old_end = extent.old_pos + extent.size;
+    }
+    return extents;
+}
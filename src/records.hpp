@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+// zstdiff metadata travels in skippable frames right before the frame it applies to,
+// plain zstd decoders skip them. Payload starts with the record kind, all fields little endian.
+constexpr std::uint32_t record_magic = 0x184D2A5Du;
+constexpr std::size_t record_header_size = 12;
+
+enum class RecordKind : std::uint32_t {
+    // next frame uses only a region of the old file as its dictionary
+    dict_window = 1,
+    // extents of the next frame hold their bytewise difference to old file, old bytes get added back after decompressing
+    byte_diff = 2,
+    // only at the start, old and new file went through the branch filter, both tools find code sections themselves
+    branch_filter = 3,
+    // only at the start after a branch filter record, new file starts and ends like old file, frames hold the middle
+    common_affix = 4,
+};
+
+struct Record {
+    RecordKind kind;
+    std::span<char const> payload;
+    // whole skippable frame, header included
+    std::size_t frame_size;
+};
+
+struct DictWindow {
+    std::uint64_t old_pos;
+    std::uint64_t old_size;
+};
+
+// Bytes at the start and end of new file that are the same as at the start and end of old file.
+struct CommonAffix {
+    std::uint64_t prefix_size;
+    std::uint64_t suffix_size;
+};
+
+constexpr std::size_t dict_window_record_size = record_header_size + 16;
+constexpr std::size_t common_affix_record_size = record_header_size + 16;
+constexpr std::size_t branch_filter_record_size = record_header_size;
+
+// Record at the start of src, empty when src starts with anything else.
+[[nodiscard]] auto read_record(std::span<char const> src) noexcept -> std::optional<Record>;
+
+[[nodiscard]] auto write_dict_window(char* dst, DictWindow const& window) noexcept -> std::size_t;
+[[nodiscard]] auto read_dict_window(Record const& record) noexcept -> std::optional<DictWindow>;
+
+[[nodiscard]] auto write_branch_filter(char* dst) noexcept -> std::size_t;
+
+[[nodiscard]] auto write_common_affix(char* dst, CommonAffix const& affix) noexcept -> std::size_t;
+[[nodiscard]] auto read_common_affix(Record const& record) noexcept -> std::optional<CommonAffix>;
+
+// Extent of a frame output that is new minus old byte by byte, new_pos is relative to the frame start.
+struct DiffExtent {
+    std::uint64_t new_pos;
+    std::uint64_t old_pos;
+    std::uint64_t size;
+};
+
+// Payload is the extent count and a zstd frame of the delta coded extents.
+[[nodiscard]] auto byte_diff_record_bound(std::size_t extent_count) noexcept -> std::size_t;
+
+// Extents have to be sorted by new position and must not overlap, returns written size or zstd error.
+[[nodiscard]] auto write_byte_diff(char* dst, std::size_t dst_size, std::span<DiffExtent const> extents) noexcept -> std::size_t;
+// Extents never cover more than new_size bytes, a record claiming more of them is rejected before allocating.
+[[nodiscard]] auto read_byte_diff(Record const& record, std::uint64_t new_size) noexcept -> std::optional<std::vector<DiffExtent>>;
@@ -0,0 +1,445 @@
+#include "ring_writer.hpp"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define RING_WRITER_IO_URING
+#endif
+#endif
+
+// one buffer gets filled while the others are written, so at most count - 1 writes are in flight
+constexpr std::size_t ring_buffer_count = 8;
+constexpr std::size_t ring_buffer_size = std::size_t { 1 } << 20;
+// O_DIRECT wants buffers, positions and sizes in whole logical blocks, 4KB covers the common ones
+constexpr std::size_t direct_alignment = 4096;
+// single calls stay below what every platform accepts
+constexpr std::size_t io_size_max = std::size_t { 1 } << 30;
+
+static auto write_at(std::intptr_t file_handle, std::uint64_t pos, std::span<char const> src) noexcept -> MMapError {
+    for (std::size_t done_size = 0; done_size != src.size();) {
+        auto const to_write = std::min(src.size() - done_size, io_size_max);
+#ifdef _WIN32
+        auto overlapped = OVERLAPPED {};
+        overlapped.Offset = static_cast<DWORD>(pos + done_size);
+        overlapped.OffsetHigh = static_cast<DWORD>((pos + done_size) >> 32);
+        auto done = DWORD {};
+        if (::WriteFile(reinterpret_cast<HANDLE>(file_handle), src.data() + done_size,
+                        static_cast<DWORD>(to_write), &done, &overlapped) == FALSE) {
+            return MMapError::with_header("write file");
+        }
+#else
+        auto const done = ::pwrite(static_cast<int>(file_handle), src.data() + done_size, to_write,
+                                   static_cast<off_t>(pos + done_size));
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return MMapError::with_header("write file");
+        }
+#endif
+        done_size += static_cast<std::size_t>(done);
+    }
+    return {};
+}
+
+// buffers in turn, one gets filled at a time and goes out at its position once full
+struct RingWriter::Ring {
+    struct Buffer {
+        char* data = {};
+        // write that is out or was last, kept so a short one can be finished
+        std::uint64_t pos = {};
+        std::size_t size = {};
+        bool in_flight = {};
+    };
+
+    std::intptr_t file_handle = {};
+    bool direct = {};
+    Buffer buffers[ring_buffer_count] = {};
+    // buffer being filled and how much of it is
+    std::size_t current = {};
+    std::size_t used = {};
+    // first write that failed, whoever waits next reports it
+    MMapError error = {};
+#ifdef RING_WRITER_IO_URING
+    int ring_fd = -1;
+    void* sq_map = {};
+    std::size_t sq_map_size = {};
+    void* cq_map = {};
+    std::size_t cq_map_size = {};
+    io_uring_sqe* sqes = {};
+    std::size_t sqes_size = {};
+    unsigned* sq_tail = {};
+    unsigned sq_mask = {};
+    unsigned* sq_array = {};
+    unsigned* cq_head = {};
+    unsigned* cq_tail = {};
+    unsigned cq_mask = {};
+    io_uring_cqe* cqes = {};
+    // buffers are registered and pinned, writes use them by index
+    bool fixed = {};
+    iovec iovecs[ring_buffer_count] = {};
+#endif
+
+    ~Ring() noexcept {
+#ifdef RING_WRITER_IO_URING
+        this->release();
+#endif
+        for (auto& buffer : this->buffers) {
+            ::operator delete(buffer.data, std::align_val_t { direct_alignment });
+        }
+    }
+
+#ifdef RING_WRITER_IO_URING
+    auto release() noexcept -> void {
+        if (this->sqes != nullptr) {
+            ::munmap(this->sqes, this->sqes_size);
+            this->sqes = nullptr;
+        }
+        if (this->cq_map != nullptr && this->cq_map != this->sq_map) {
+            ::munmap(this->cq_map, this->cq_map_size);
+        }
+        this->cq_map = nullptr;
+        if (this->sq_map != nullptr) {
+            ::munmap(this->sq_map, this->sq_map_size);
+            this->sq_map = nullptr;
+        }
+        // unregisters the buffers too
+        if (this->ring_fd != -1) {
+            ::close(this->ring_fd);
+            this->ring_fd = -1;
+        }
+    }
+
+    // false leaves writes in place, io_uring may be missing, too old or turned off by seccomp or sysctl
+    auto setup() noexcept -> bool {
+        // a write and the writeback behind it per buffer
+        auto params = io_uring_params {};
+        auto const fd = static_cast<int>(::syscall(__NR_io_uring_setup, ring_buffer_count * 2, &params));
+        if (fd < 0) {
+            return false;
+        }
+        this->ring_fd = fd;
+        this->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        this->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        auto single_map = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+        single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#endif
+        if (single_map) {
+            this->sq_map_size = this->cq_map_size = std::max(this->sq_map_size, this->cq_map_size);
+        }
+        auto const sq_map = ::mmap(nullptr, this->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                   fd, IORING_OFF_SQ_RING);
+        if (sq_map == MAP_FAILED) {
+            return false;
+        }
+        this->sq_map = sq_map;
+        auto const cq_map = single_map
+            ? sq_map
+            : ::mmap(nullptr, this->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_CQ_RING);
+        if (cq_map == MAP_FAILED) {
+            return false;
+        }
+        this->cq_map = cq_map;
+        this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        auto const sqes = ::mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+        this->sqes = static_cast<io_uring_sqe*>(sqes);
+        auto const sq = static_cast<char*>(sq_map);
+        auto const cq = static_cast<char*>(cq_map);
+        this->sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        this->sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        this->sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        this->cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        this->cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        this->cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        this->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        for (std::size_t i = 0; i != ring_buffer_count; ++i) {
+            this->iovecs[i] = { this->buffers[i].data, ring_buffer_size };
+        }
+        // pinning counts against the memlock limit, plain writes do without
+        this->fixed = ::syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+                                this->iovecs, ring_buffer_count) == 0;
+        return true;
+    }
+
+    auto push(std::uint8_t opcode, std::size_t index, std::uint8_t flags, std::uint64_t user_data) noexcept -> void {
+        auto const tail = *this->sq_tail;
+        auto const slot = tail & this->sq_mask;
+        auto& sqe = this->sqes[slot];
+        auto const& buffer = this->buffers[index];
+        ::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.flags = flags;
+        sqe.fd = static_cast<int>(this->file_handle);
+        sqe.off = buffer.pos;
+        sqe.user_data = user_data;
+        if (opcode == IORING_OP_WRITE_FIXED) {
+            sqe.addr = reinterpret_cast<std::uintptr_t>(buffer.data);
+            sqe.len = static_cast<std::uint32_t>(buffer.size);
+            sqe.buf_index = static_cast<std::uint16_t>(index);
+        } else if (opcode == IORING_OP_WRITEV) {
+            this->iovecs[index].iov_len = buffer.size;
+            sqe.addr = reinterpret_cast<std::uintptr_t>(&this->iovecs[index]);
+            sqe.len = 1;
+        } else {
+            sqe.len = static_cast<std::uint32_t>(buffer.size);
+            sqe.sync_range_flags = SYNC_FILE_RANGE_WRITE;
+        }
+        this->sq_array[slot] = slot;
+        std::atomic_ref { *this->sq_tail }.store(tail + 1, std::memory_order_release);
+    }
+
+    auto enter(unsigned to_submit, unsigned min_complete) noexcept -> MMapError {
+        while (to_submit != 0 || min_complete != 0) {
+            auto const result = ::syscall(__NR_io_uring_enter, this->ring_fd, to_submit, min_complete,
+                                          min_complete != 0 ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return MMapError::with_header("submit writes");
+            }
+            to_submit -= static_cast<unsigned>(result);
+            min_complete = 0;
+        }
+        return {};
+    }
+
+    // completions so far, a buffer whose write is done can be filled again
+    auto reap() noexcept -> void {
+        auto head = *this->cq_head;
+        auto const tail = std::atomic_ref { *this->cq_tail }.load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            auto const& cqe = this->cqes[head & this->cq_mask];
+            // writeback only gets started, nothing depends on it, it fails along with a failed write
+            if (cqe.user_data % 2 != 0) {
+                continue;
+            }
+            auto& buffer = this->buffers[cqe.user_data / 2];
+            buffer.in_flight = false;
+            if (cqe.res < 0) {
+                if (!this->error) {
+                    this->error = { "write file", -cqe.res };
+                }
+            } else if (static_cast<std::size_t>(cqe.res) < buffer.size) {
+                // rare for regular files, the rest goes in place
+                auto const done = static_cast<std::size_t>(cqe.res);
+                if (auto error = write_at(this->file_handle, buffer.pos + done,
+                                          { buffer.data + done, buffer.size - done }); error && !this->error) {
+                    this->error = error;
+                }
+            }
+        }
+        std::atomic_ref { *this->cq_head }.store(head, std::memory_order_release);
+    }
+#endif
+
+    auto submit(std::size_t index, std::uint64_t pos, std::size_t size) noexcept -> MMapError {
+        auto& buffer = this->buffers[index];
+        buffer.pos = pos;
+        buffer.size = size;
+#ifdef RING_WRITER_IO_URING
+        if (this->ring_fd != -1) {
+            auto const opcode = this->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITEV;
+            // page cache writeback starts right behind the write instead of all at once in the final sync
+            auto const sync = !this->direct;
+            this->push(static_cast<std::uint8_t>(opcode), index, sync ? IOSQE_IO_LINK : 0, index * 2);
+            if (sync) {
+                this->push(IORING_OP_SYNC_FILE_RANGE, index, 0, index * 2 + 1);
+            }
+            buffer.in_flight = true;
+            return this->enter(sync ? 2 : 1, 0);
+        }
+#endif
+        return write_at(this->file_handle, pos, { buffer.data, size });
+    }
+
+    auto wait(std::size_t index) noexcept -> MMapError {
+#ifdef RING_WRITER_IO_URING
+        while (this->buffers[index].in_flight) {
+            this->reap();
+            if (!this->buffers[index].in_flight) {
+                break;
+            }
+            if (auto error = this->enter(0, 1)) {
+                return error;
+            }
+        }
+#else
+        (void)index;
+#endif
+        return this->error;
+    }
+};
+
+RingWriter::RingWriter() noexcept = default;
+
+RingWriter::~RingWriter() noexcept {
+    if (auto error = this->close()) {
+        ::fprintf(stderr, "Failed to close at %s because %d(%s)\n",
+                  error.header, error.errnum, ::strerror(error.errnum));
+        ::exit(EXIT_FAILURE);
+    }
+}
+
+auto RingWriter::create(std::filesystem::path const& path, bool direct) noexcept -> MMapError {
+    if (auto error = this->close()) {
+        return error;
+    }
+    auto ring = std::make_unique<Ring>();
+#ifdef _WIN32
+    auto const flags = direct ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : FILE_ATTRIBUTE_NORMAL;
+    auto const raw_file_handle = ::CreateFile(path.string().c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                                              0, CREATE_ALWAYS, flags, 0);
+    if (raw_file_handle == INVALID_HANDLE_VALUE || raw_file_handle == nullptr) {
+        return MMapError::with_header("open file handle");
+    }
+    ring->direct = direct;
+    this->file_handle_ = reinterpret_cast<std::intptr_t>(raw_file_handle);
+#else
+    auto raw_file_handle = -1;
+#ifdef O_DIRECT
+    if (direct) {
+        raw_file_handle = ::open(path.string().c_str(), O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        // tmpfs and some network file systems refuse it
+        if (raw_file_handle == -1 && errno != EINVAL) {
+            return MMapError::with_header("open file handle");
+        }
+        ring->direct = raw_file_handle != -1;
+    }
+#endif
+    if (raw_file_handle == -1) {
+        raw_file_handle = ::open(path.string().c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (raw_file_handle == -1) {
+            return MMapError::with_header("open file handle");
+        }
+    }
+    this->file_handle_ = static_cast<std::intptr_t>(raw_file_handle);
+#endif
+    ring->file_handle = this->file_handle_;
+    for (auto& buffer : ring->buffers) {
+        buffer.data = static_cast<char*>(::operator new(ring_buffer_size, std::align_val_t { direct_alignment }));
+    }
+#ifdef RING_WRITER_IO_URING
+    if (!ring->setup()) {
+        // writes stay in place
+        ring->release();
+    }
+#endif
+    this->ring_ = static_cast<std::unique_ptr<Ring>&&>(ring);
+    this->size_ = 0;
+    this->is_open_ = true;
+    return {};
+}
+
+auto RingWriter::close() noexcept -> MMapError {
+    if (!this->is_open_) {
+        return {};
+    }
+    this->is_open_ = false;
+    auto& ring = *this->ring_;
+    auto error = MMapError {};
+    if (ring.used != 0 && !ring.error) {
+        // O_DIRECT writes whole blocks, what the last one has too many gets cut off below
+        auto const size = ring.direct
+            ? (ring.used + direct_alignment - 1) & ~(direct_alignment - 1)
+            : ring.used;
+        ::memset(ring.buffers[ring.current].data + ring.used, 0, size - ring.used);
+        error = ring.submit(ring.current, this->size_ - ring.used, size);
+    }
+    for (std::size_t i = 0; i != ring_buffer_count; ++i) {
+        if (auto wait_error = ring.wait(i); !error) {
+            error = wait_error;
+        }
+    }
+    auto const raw_file_handle = this->file_handle_;
+#ifdef _WIN32
+    if (!error && ring.direct) {
+        auto pos = LARGE_INTEGER {};
+        pos.QuadPart = static_cast<LONGLONG>(this->size_);
+        if (::SetFilePointerEx(reinterpret_cast<HANDLE>(raw_file_handle), pos, nullptr, FILE_BEGIN) == FALSE
+            || ::SetEndOfFile(reinterpret_cast<HANDLE>(raw_file_handle)) == FALSE) {
+            error = MMapError::with_header("truncate file");
+        }
+    }
+    // same durability as a mapping that got flushed, writeback has mostly happened by now
+    if (!error && ::FlushFileBuffers(reinterpret_cast<HANDLE>(raw_file_handle)) == FALSE) {
+        error = MMapError::with_header("sync file");
+    }
+    if (::CloseHandle(reinterpret_cast<HANDLE>(raw_file_handle)) == FALSE && !error) {
+        error = MMapError::with_header("close file handle");
+    }
+#else
+    if (!error && ring.direct && ::ftruncate(static_cast<int>(raw_file_handle), static_cast<off_t>(this->size_)) != 0) {
+        error = MMapError::with_header("truncate file");
+    }
+    // same durability as a mapping that got flushed, writeback has mostly happened by now
+    if (!error && ::fdatasync(static_cast<int>(raw_file_handle)) != 0) {
+        error = MMapError::with_header("sync file");
+    }
+    if (::close(static_cast<int>(raw_file_handle)) != 0 && !error) {
+        error = MMapError::with_header("close file handle");
+    }
+#endif
+    this->ring_.reset();
+    return error;
+}
+
+auto RingWriter::reserve(std::span<char>& out) noexcept -> MMapError {
+    auto& ring = *this->ring_;
+    if (ring.used == 0) {
+        if (auto error = ring.wait(ring.current)) {
+            return error;
+        }
+    }
+    out = { ring.buffers[ring.current].data + ring.used, ring_buffer_size - ring.used };
+    return {};
+}
+
+auto RingWriter::commit(std::size_t size) noexcept -> MMapError {
+    auto& ring = *this->ring_;
+    ring.used += size;
+    this->size_ += size;
+    if (ring.used != ring_buffer_size) {
+        return {};
+    }
+    auto const index = ring.current;
+    ring.current = (ring.current + 1) % ring_buffer_count;
+    ring.used = 0;
+    return ring.submit(index, this->size_ - ring_buffer_size, ring_buffer_size);
+}
+
+auto RingWriter::write(std::span<char const> src) noexcept -> MMapError {
+    while (!src.empty()) {
+        auto out = std::span<char> {};
+        if (auto error = this->reserve(out)) {
+            return error;
+        }
+        auto const size = std::min(out.size(), src.size());
+        std::copy_n(src.data(), size, out.data());
+        if (auto error = this->commit(size)) {
+            return error;
+        }
+        src = src.subspan(size);
+    }
+    return {};
+}
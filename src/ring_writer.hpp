@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include "mmap.hpp"
+
+// Writer for a file produced front to back into buffers of its own, a filled buffer gets written at its position
+// while the next ones fill. On Linux writes go through io_uring with at most one per buffer in flight, buffers are
+// registered so they stay pinned and writeback starts right behind every write, nothing piles up for the end.
+// Elsewhere, or where io_uring is not allowed, every buffer is written out in place once it is full.
+struct RingWriter {
+    [[nodiscard]] RingWriter() noexcept;
+    RingWriter(RingWriter const&) = delete;
+    RingWriter& operator=(RingWriter const&) = delete;
+    ~RingWriter() noexcept;
+
+    // creates or truncates the file, direct bypasses the page cache with O_DIRECT where the file system allows it
+    [[nodiscard]] auto create(std::filesystem::path const& path, bool direct) noexcept -> MMapError;
+    // writes what is left, waits for every write and cuts the file to what got written
+    [[nodiscard]] auto close() noexcept -> MMapError;
+
+    // room left in the buffer being filled, never empty, waits for the write of the next buffer when it is full
+    [[nodiscard]] auto reserve(std::span<char>& out) noexcept -> MMapError;
+    // size bytes at the start of what reserve handed out are output, a full buffer goes out right away
+    [[nodiscard]] auto commit(std::size_t size) noexcept -> MMapError;
+    [[nodiscard]] auto write(std::span<char const> src) noexcept -> MMapError;
+
+    // everything written so far, in flight or not
+    [[nodiscard]] inline auto size() const noexcept -> std::uint64_t {
+        return this->size_;
+    }
+
+private:
+    struct Ring;
+
+    std::intptr_t file_handle_ = {};
+    std::unique_ptr<Ring> ring_;
+    std::uint64_t size_ = {};
+    bool is_open_ = {};
+};
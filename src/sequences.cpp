@@ -0,0 +1,152 @@
+#include "sequences.hpp"
+#include <algorithm>
+#include <bit>
+#include <span>
+#include <utility>
+#include "common/zstd_errors.h"
+
+static auto zstd_error(ZSTD_ErrorCode code) noexcept -> std::size_t {
+    return static_cast<std::size_t>(-static_cast<std::ptrdiff_t>(code));
+}
+
+auto SequenceList::add_literals(std::uint64_t count) noexcept -> void {
+    this->literals += count;
+    this->size += count;
+}
+
+auto SequenceList::add_match(std::uint32_t offset, std::uint64_t length) noexcept -> void {
+    // split so every piece length fits, remaining pieces turn into repcodes
+    constexpr auto length_max = std::uint64_t { 1u << 31 };
+    while (length != 0) {
+        auto const chunk = std::min(length, length_max);
+        this->entries.push_back({ this->literals, offset, static_cast<std::uint32_t>(chunk) });
+        this->literals = 0;
+        this->size += chunk;
+        length -= chunk;
+    }
+}
+
+auto SequenceList::append(SequenceList&& other) noexcept -> void {
+    if (other.entries.empty()) {
+        this->literals += other.literals;
+    } else {
+        other.entries.front().literals += this->literals;
+        if (this->entries.empty()) {
+            this->entries = static_cast<std::vector<Entry>&&>(other.entries);
+        } else {
+            this->entries.insert(this->entries.end(), other.entries.begin(), other.entries.end());
+        }
+        this->literals = other.literals;
+    }
+    this->size += other.size;
+    other = {};
+}
+
+auto SequenceGenerator::generate(ZSTD_CCtx* ctx,
+                                 char const* src, std::size_t src_size, std::size_t region_pos,
+                                 SequenceList& out) noexcept -> std::size_t {
+    // every match is at least 3 bytes long and every block ends with a delimiter
+    auto const max_sequences = src_size / ZSTD_MINMATCH_MIN + src_size / ZSTD_BLOCKSIZE_MAX + 2;
+    if (this->scratch_.size() < max_sequences) {
+        this->scratch_.resize(max_sequences);
+    }
+    auto const count = ZSTD_generateSequences(ctx, this->scratch_.data(), this->scratch_.size(), src, src_size);
+    if (ZSTD_isError(count)) {
+        return count;
+    }
+    auto pos = std::uint64_t{};
+    for (auto const& sequence : std::span { this->scratch_.data(), count }) {
+        out.add_literals(sequence.litLength);
+        pos += sequence.litLength;
+        if (sequence.matchLength == 0) {
+            continue;
+        }
+        // matches reaching before region start point into old file, skip the new file bytes in between
+        auto const offset = sequence.offset > pos ? sequence.offset + region_pos : sequence.offset;
+        out.add_match(static_cast<std::uint32_t>(offset), sequence.matchLength);
+        pos += sequence.matchLength;
+    }
+    if (pos > src_size) {
+        return zstd_error(ZSTD_error_corruption_detected);
+    }
+    // blocks too small to compress are never reported
+    out.add_literals(src_size - pos);
+    return 0;
+}
+
+auto compress_sequences(ZSTD_CCtx* ctx, SequenceList const& list,
+                        char const* src, std::size_t src_size,
+                        char* dst, std::size_t dst_size) noexcept -> std::size_t {
+    if (list.size != src_size) {
+        return zstd_error(ZSTD_error_srcSize_wrong);
+    }
+    // window only needs to cover the frame, old file is referenced as dictionary content
+    auto const window_log = std::clamp(static_cast<int>(std::bit_width(src_size)),
+                                       ZSTD_WINDOWLOG_MIN,
+                                       ZSTD_WINDOWLOG_MAX);
+    ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+    for (auto const& [param, value] : {
+             std::pair { ZSTD_c_strategy, static_cast<int>(ZSTD_btultra2) },
+             std::pair { ZSTD_c_windowLog, window_log },
+             std::pair { ZSTD_c_hashLog, ZSTD_HASHLOG_MIN },
+             std::pair { ZSTD_c_chainLog, ZSTD_CHAINLOG_MIN },
+             std::pair { ZSTD_c_searchLog, ZSTD_SEARCHLOG_MIN },
+             std::pair { ZSTD_c_minMatch, ZSTD_MINMATCH_MIN },
+             std::pair { ZSTD_c_checksumFlag, 1 },
+             std::pair { ZSTD_c_blockDelimiters, static_cast<int>(ZSTD_sf_explicitBlockDelimiters) },
+         }) {
+        if (auto const error = ZSTD_CCtx_setParameter(ctx, param, value); ZSTD_isError(error)) {
+            return error;
+        }
+    }
+
+    // cut sequences at block boundaries, pieces too short for a match are sent as literals
+    auto const block_size_max = std::min(std::uint64_t { ZSTD_BLOCKSIZE_MAX }, std::uint64_t { 1 } << window_log);
+    auto sequences = std::vector<ZSTD_Sequence>();
+    sequences.reserve(list.entries.size() + src_size / block_size_max + 1);
+    auto remaining = std::uint64_t { src_size };
+    auto block_size = std::min(block_size_max, remaining);
+    auto block_left = block_size;
+    auto block_literals = std::uint32_t{};
+    auto const end_block = [&] () noexcept {
+        sequences.push_back({ 0, block_literals, 0, 0 });
+        block_literals = 0;
+        remaining -= block_size;
+        block_size = std::min(block_size_max, remaining);
+        block_left = block_size;
+    };
+    auto const add_literals = [&] (std::uint64_t length) noexcept {
+        while (length != 0) {
+            auto const chunk = std::min(length, block_left);
+            block_literals += static_cast<std::uint32_t>(chunk);
+            block_left -= chunk;
+            length -= chunk;
+            if (block_left == 0) {
+                end_block();
+            }
+        }
+    };
+    auto const add_match = [&] (std::uint32_t offset, std::uint64_t length) noexcept {
+        while (length != 0) {
+            auto const chunk = std::min(length, block_left);
+            if (chunk < ZSTD_MINMATCH_MIN) {
+                block_literals += static_cast<std::uint32_t>(chunk);
+            } else {
+                sequences.push_back({ offset, block_literals, static_cast<std::uint32_t>(chunk), 0 });
+                block_literals = 0;
+            }
+            block_left -= chunk;
+            length -= chunk;
+            if (block_left == 0) {
+                end_block();
+            }
+        }
+    };
+    for (auto const& entry : list.entries) {
+        add_literals(entry.literals);
+        add_match(entry.offset, entry.length);
+    }
+    add_literals(list.literals);
+
+    return ZSTD_compressSequences(ctx, dst, dst_size, sequences.data(), sequences.size(), src, src_size);
+}
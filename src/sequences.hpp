@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "zstd.h"
+
+// offset + repcode bias has to fit into 32bits
+constexpr std::uint64_t sequence_offset_max = 0xFFFFFFFFu - 3u;
+
+// Matches into the virtual buffer [old file][new file], offsets are distances back from the match start.
+// Regions of the new file can be collected independently and appended in order afterwards.
+struct SequenceList {
+    struct Entry {
+        std::uint64_t literals;
+        std::uint32_t offset;
+        std::uint32_t length;
+    };
+
+    std::vector<Entry> entries = {};
+    std::uint64_t literals = {};
+    std::uint64_t size = {};
+
+    auto add_literals(std::uint64_t count) noexcept -> void;
+    auto add_match(std::uint32_t offset, std::uint64_t length) noexcept -> void;
+    auto append(SequenceList&& other) noexcept -> void;
+};
+
+// Collects the sequences zstd finds for one region of the new file.
+// Context must reference the old file as dictionary, region starts at region_pos in the new file.
+struct SequenceGenerator {
+    [[nodiscard]] auto generate(ZSTD_CCtx* ctx,
+                                char const* src, std::size_t src_size, std::size_t region_pos,
+                                SequenceList& out) noexcept -> std::size_t;
+
+private:
+    std::vector<ZSTD_Sequence> scratch_ = {};
+};
+
+// Entropy codes sequences into one standard frame, returns compressed size or zstd error.
+// Context parameters are reset, no match search happens here.
+[[nodiscard]] auto compress_sequences(ZSTD_CCtx* ctx, SequenceList const& list,
+                                      char const* src, std::size_t src_size,
+                                      char* dst, std::size_t dst_size) noexcept -> std::size_t;
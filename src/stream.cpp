@@ -0,0 +1,483 @@
+#include "stream.hpp"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+// writes go out in pieces of about this size
+constexpr std::size_t stream_buffer_size = std::size_t { 1 } << 20;
+// single calls stay below what every platform accepts
+constexpr std::size_t io_size_max = std::size_t { 1 } << 30;
+// one buffer gets filled while the one before it is in use
+constexpr std::size_t prefetch_buffer_count = 2;
+// O_DIRECT wants buffers, positions and sizes in whole logical blocks, 4KB covers the common ones
+constexpr std::size_t direct_alignment = 4096;
+
+static auto close_handle(std::intptr_t file_handle) noexcept -> MMapError {
+#ifdef _WIN32
+    if (::CloseHandle(reinterpret_cast<HANDLE>(file_handle)) == FALSE) {
+        return MMapError::with_header("close file handle");
+    }
+#else
+    if (::close(static_cast<int>(file_handle)) != 0) {
+        return MMapError::with_header("close file handle");
+    }
+#endif
+    return {};
+}
+
+static auto close_or_panic(MMapError const& error) noexcept -> void {
+    if (error) {
+        ::fprintf(stderr, "Failed to close at %s because %d(%s)\n",
+                  error.header, error.errnum, ::strerror(error.errnum));
+        ::exit(EXIT_FAILURE);
+    }
+}
+
+auto StreamReader::open(std::filesystem::path const& path) noexcept -> MMapError {
+    if (auto error = this->close()) {
+        return error;
+    }
+    this->is_std_ = path == "-";
+#ifdef _WIN32
+    auto const raw_file_handle = this->is_std_
+        ? ::GetStdHandle(STD_INPUT_HANDLE)
+        : ::CreateFile(path.string().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                       0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (raw_file_handle == INVALID_HANDLE_VALUE || raw_file_handle == nullptr) {
+        return MMapError::with_header("open file handle");
+    }
+    this->file_handle_ = reinterpret_cast<std::intptr_t>(raw_file_handle);
+#else
+    auto const raw_file_handle = this->is_std_ ? STDIN_FILENO : ::open(path.string().c_str(), O_RDONLY);
+    if (raw_file_handle == -1) {
+        return MMapError::with_header("open file handle");
+    }
+    this->file_handle_ = static_cast<std::intptr_t>(raw_file_handle);
+#endif
+    this->is_open_ = true;
+    return {};
+}
+
+// reads at pos until dst is full or the file ends, a read that is not a whole number of blocks is the end,
+// as the next one would not be aligned for O_DIRECT
+static auto read_at(std::intptr_t file_handle, std::uint64_t pos, std::span<char> dst,
+                    std::size_t& size) noexcept -> MMapError {
+    size = 0;
+    while (size != dst.size()) {
+        auto const to_read = std::min(dst.size() - size, io_size_max);
+#ifdef _WIN32
+        auto overlapped = OVERLAPPED {};
+        overlapped.Offset = static_cast<DWORD>(pos + size);
+        overlapped.OffsetHigh = static_cast<DWORD>((pos + size) >> 32);
+        auto done = DWORD {};
+        if (::ReadFile(reinterpret_cast<HANDLE>(file_handle), dst.data() + size,
+                       static_cast<DWORD>(to_read), &done, &overlapped) == FALSE) {
+            if (::GetLastError() == ERROR_HANDLE_EOF) {
+                break;
+            }
+            return MMapError::with_header("read file");
+        }
+#else
+        auto const done = ::pread(static_cast<int>(file_handle), dst.data() + size, to_read,
+                                  static_cast<off_t>(pos + size));
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return MMapError::with_header("read file");
+        }
+#endif
+        size += static_cast<std::size_t>(done);
+        if (done == 0 || static_cast<std::size_t>(done) % direct_alignment != 0) {
+            break;
+        }
+    }
+    return {};
+}
+
+// chunks of the file in turn, the thread reads the next ones while the consumer holds the last one it got
+struct StreamReader::Prefetch {
+    struct Buffer {
+        char* data = {};
+        std::size_t size = {};
+        MMapError error = {};
+    };
+
+    std::intptr_t file_handle = {};
+    std::size_t buffer_size = {};
+    // pread standing in for O_DIRECT, pages get dropped from the cache once read
+    bool drop_cache = {};
+    Buffer buffers[prefetch_buffer_count] = {};
+    std::mutex mutex = {};
+    std::condition_variable changed = {};
+    // chunks the thread read and the consumer got so far, chunk taken - 1 is held until the next view,
+    // so the thread can fill every buffer but that one
+    std::uint64_t filled = {};
+    std::uint64_t taken = {};
+    // thread read the last chunk or failed
+    bool done = {};
+    bool stop = {};
+    std::thread thread = {};
+
+    ~Prefetch() noexcept {
+        {
+            auto lock = std::unique_lock { this->mutex };
+            this->stop = true;
+        }
+        this->changed.notify_all();
+        if (this->thread.joinable()) {
+            this->thread.join();
+        }
+        for (auto& buffer : this->buffers) {
+            ::operator delete(buffer.data, std::align_val_t { direct_alignment });
+        }
+    }
+
+    auto run() noexcept -> void {
+        for (std::uint64_t chunk = 0;; ++chunk) {
+            {
+                auto lock = std::unique_lock { this->mutex };
+                this->changed.wait(lock, [&] {
+                    return this->stop || chunk + 1 < this->taken + prefetch_buffer_count;
+                });
+                if (this->stop) {
+                    return;
+                }
+            }
+            auto& buffer = this->buffers[chunk % prefetch_buffer_count];
+            auto const pos = chunk * this->buffer_size;
+            buffer.error = read_at(this->file_handle, pos, { buffer.data, this->buffer_size }, buffer.size);
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+            if (this->drop_cache && buffer.size != 0) {
+                ::posix_fadvise(static_cast<int>(this->file_handle), static_cast<off_t>(pos),
+                                static_cast<off_t>(buffer.size), POSIX_FADV_DONTNEED);
+            }
+#endif
+            auto const last = buffer.error || buffer.size != this->buffer_size;
+            {
+                auto lock = std::unique_lock { this->mutex };
+                this->filled = chunk + 1;
+                this->done = last;
+            }
+            this->changed.notify_all();
+            if (last) {
+                return;
+            }
+        }
+    }
+};
+
+StreamReader::StreamReader() noexcept = default;
+
+StreamReader::~StreamReader() noexcept {
+    close_or_panic(this->close());
+}
+
+auto StreamReader::open(std::filesystem::path const& path, std::size_t window_size,
+                        ReadBackend backend) noexcept -> MMapError {
+    if (auto error = this->close()) {
+        return error;
+    }
+    this->window_pos_ = 0;
+    if (backend == ReadBackend::mmap) {
+        if (auto error = this->window_.open(path, window_size)) {
+            return error;
+        }
+        this->window_size_ = this->window_.window_size();
+        return {};
+    }
+    auto prefetch = std::make_unique<Prefetch>();
+#ifdef _WIN32
+    auto const flags = backend == ReadBackend::direct
+        ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN
+        : FILE_FLAG_SEQUENTIAL_SCAN;
+    auto const raw_file_handle = ::CreateFile(path.string().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                              0, OPEN_EXISTING, flags, 0);
+    if (raw_file_handle == INVALID_HANDLE_VALUE || raw_file_handle == nullptr) {
+        return MMapError::with_header("open file handle");
+    }
+    prefetch->file_handle = reinterpret_cast<std::intptr_t>(raw_file_handle);
+#else
+    auto raw_file_handle = -1;
+#ifdef O_DIRECT
+    if (backend == ReadBackend::direct) {
+        raw_file_handle = ::open(path.string().c_str(), O_RDONLY | O_DIRECT);
+        // tmpfs and some network file systems refuse it
+        if (raw_file_handle == -1 && errno != EINVAL) {
+            return MMapError::with_header("open file handle");
+        }
+    }
+#endif
+    if (raw_file_handle == -1) {
+        raw_file_handle = ::open(path.string().c_str(), O_RDONLY);
+        if (raw_file_handle == -1) {
+            return MMapError::with_header("open file handle");
+        }
+        prefetch->drop_cache = backend == ReadBackend::direct;
+#ifdef POSIX_FADV_SEQUENTIAL
+        ::posix_fadvise(raw_file_handle, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+    prefetch->file_handle = static_cast<std::intptr_t>(raw_file_handle);
+#endif
+    prefetch->buffer_size = (std::max(window_size, std::size_t { 1 }) + direct_alignment - 1) & ~(direct_alignment - 1);
+    for (auto& buffer : prefetch->buffers) {
+        buffer.data = static_cast<char*>(::operator new(prefetch->buffer_size, std::align_val_t { direct_alignment }));
+    }
+    prefetch->thread = std::thread([prefetch = prefetch.get()] () noexcept {
+        prefetch->run();
+    });
+    this->window_size_ = prefetch->buffer_size;
+    this->prefetch_ = static_cast<std::unique_ptr<Prefetch>&&>(prefetch);
+    return {};
+}
+
+auto StreamReader::close() noexcept -> MMapError {
+    this->window_size_ = 0;
+    if (this->prefetch_) {
+        // stops the thread before its handle goes
+        auto const file_handle = this->prefetch_->file_handle;
+        this->prefetch_.reset();
+        return close_handle(file_handle);
+    }
+    if (this->window_) {
+        return this->window_.close();
+    }
+    if (!this->is_open_) {
+        return {};
+    }
+    this->is_open_ = false;
+    // stdin stays open for whoever else reads it
+    return this->is_std_ ? MMapError {} : close_handle(this->file_handle_);
+}
+
+auto StreamReader::view(std::span<char const>& out) noexcept -> MMapError {
+    if (this->prefetch_) {
+        auto& prefetch = *this->prefetch_;
+        auto lock = std::unique_lock { prefetch.mutex };
+        prefetch.changed.wait(lock, [&] {
+            return prefetch.filled > prefetch.taken || prefetch.done;
+        });
+        // last chunk is handed out already
+        if (prefetch.filled == prefetch.taken) {
+            out = {};
+            return {};
+        }
+        auto const& buffer = prefetch.buffers[prefetch.taken % prefetch_buffer_count];
+        ++prefetch.taken;
+        lock.unlock();
+        // the chunk before this one is free to be filled again
+        prefetch.changed.notify_all();
+        out = { buffer.data, buffer.size };
+        return buffer.error;
+    }
+    auto const left = this->window_.size() - this->window_pos_;
+    auto const view_size = static_cast<std::size_t>(std::min<std::uint64_t>(this->window_size_, left));
+    if (auto error = this->window_.view(this->window_pos_, view_size, out)) {
+        return error;
+    }
+    this->window_pos_ += view_size;
+    return {};
+}
+
+auto StreamReader::read(std::span<char> dst, std::size_t& size) noexcept -> MMapError {
+    size = 0;
+    // pipes return whatever is buffered, keep going until dst is full or the writer is done
+    while (size != dst.size()) {
+        auto const to_read = std::min(dst.size() - size, io_size_max);
+#ifdef _WIN32
+        auto done = DWORD {};
+        if (::ReadFile(reinterpret_cast<HANDLE>(this->file_handle_), dst.data() + size,
+                       static_cast<DWORD>(to_read), &done, nullptr) == FALSE) {
+            // writer closing its end of a pipe is the end of input
+            if (::GetLastError() == ERROR_BROKEN_PIPE) {
+                break;
+            }
+            return MMapError::with_header("read file");
+        }
+#else
+        auto const done = ::read(static_cast<int>(this->file_handle_), dst.data() + size, to_read);
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return MMapError::with_header("read file");
+        }
+#endif
+        if (done == 0) {
+            break;
+        }
+        size += static_cast<std::size_t>(done);
+    }
+    return {};
+}
+
+StreamWriter::~StreamWriter() noexcept {
+    close_or_panic(this->close());
+}
+
+auto StreamWriter::create(std::filesystem::path const& path) noexcept -> MMapError {
+    if (auto error = this->close()) {
+        return error;
+    }
+#ifdef _WIN32
+    if (path == "-") {
+        // output keeps the original stdout, prints follow stderr from here on
+        ::fflush(stdout);
+        auto const raw_file_handle = ::GetStdHandle(STD_OUTPUT_HANDLE);
+        auto duplicate = HANDLE {};
+        if (::DuplicateHandle(::GetCurrentProcess(), raw_file_handle, ::GetCurrentProcess(), &duplicate,
+                              0, FALSE, DUPLICATE_SAME_ACCESS) == FALSE
+            || ::_dup2(::_fileno(stderr), ::_fileno(stdout)) != 0) {
+            return MMapError::with_header("duplicate stdout");
+        }
+        this->file_handle_ = reinterpret_cast<std::intptr_t>(duplicate);
+    } else {
+        auto const raw_file_handle = ::CreateFile(path.string().c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+                                                  0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+        if (raw_file_handle == INVALID_HANDLE_VALUE || raw_file_handle == nullptr) {
+            return MMapError::with_header("open file handle");
+        }
+        this->file_handle_ = reinterpret_cast<std::intptr_t>(raw_file_handle);
+    }
+#else
+    if (path == "-") {
+        // output keeps the original stdout, prints follow stderr from here on
+        ::fflush(stdout);
+        auto const raw_file_handle = ::dup(STDOUT_FILENO);
+        if (raw_file_handle == -1 || ::dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+            return MMapError::with_header("duplicate stdout");
+        }
+        this->file_handle_ = static_cast<std::intptr_t>(raw_file_handle);
+    } else {
+        auto const raw_file_handle = ::open(path.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (raw_file_handle == -1) {
+            return MMapError::with_header("open file handle");
+        }
+        this->file_handle_ = static_cast<std::intptr_t>(raw_file_handle);
+    }
+#endif
+    this->size_ = 0;
+    this->buffer_.resize(stream_buffer_size);
+    this->buffer_used_ = 0;
+    this->is_open_ = true;
+    return {};
+}
+
+auto StreamWriter::close() noexcept -> MMapError {
+    if (!this->is_open_) {
+        return {};
+    }
+    auto error = this->flush();
+    this->is_open_ = false;
+    this->buffer_ = {};
+    if (auto close_error = close_handle(this->file_handle_); !error) {
+        error = close_error;
+    }
+    return error;
+}
+
+auto StreamWriter::write(std::span<char const> src) noexcept -> MMapError {
+    if (src.size() <= this->buffer_.size() - this->buffer_used_) {
+        std::copy(src.begin(), src.end(), this->buffer_.begin() + static_cast<std::ptrdiff_t>(this->buffer_used_));
+        return this->commit(src.size());
+    }
+    // too large to be worth buffering, goes out right behind what is buffered
+    if (auto error = this->flush()) {
+        return error;
+    }
+    if (auto error = this->write_raw(src)) {
+        return error;
+    }
+    this->size_ += src.size();
+    return {};
+}
+
+auto StreamWriter::flush() noexcept -> MMapError {
+    auto const used = this->buffer_used_;
+    this->buffer_used_ = 0;
+    return this->write_raw({ this->buffer_.data(), used });
+}
+
+auto StreamWriter::reserve(std::size_t size) noexcept -> std::span<char> {
+    if (this->buffer_.size() - this->buffer_used_ < size) {
+        this->buffer_.resize(this->buffer_used_ + size);
+    }
+    return { this->buffer_.data() + this->buffer_used_, this->buffer_.size() - this->buffer_used_ };
+}
+
+auto StreamWriter::commit(std::size_t size) noexcept -> MMapError {
+    this->buffer_used_ += size;
+    this->size_ += size;
+    if (this->buffer_used_ < stream_buffer_size) {
+        return {};
+    }
+    // reserve can grow it for one large piece, back to normal once that is out
+    auto error = this->flush();
+    this->buffer_.resize(stream_buffer_size);
+    this->buffer_.shrink_to_fit();
+    return error;
+}
+
+auto StreamWriter::truncate(std::uint64_t size) noexcept -> MMapError {
+    auto const written = this->size_ - this->buffer_used_;
+    if (size >= written) {
+        this->buffer_used_ = static_cast<std::size_t>(size - written);
+        this->size_ = size;
+        return {};
+    }
+    this->buffer_used_ = 0;
+    this->size_ = written;
+#ifdef _WIN32
+    auto pos = LARGE_INTEGER {};
+    pos.QuadPart = static_cast<LONGLONG>(size);
+    if (::SetFilePointerEx(reinterpret_cast<HANDLE>(this->file_handle_), pos, nullptr, FILE_BEGIN) == FALSE
+        || ::SetEndOfFile(reinterpret_cast<HANDLE>(this->file_handle_)) == FALSE) {
+        return MMapError::with_header("truncate file");
+    }
+#else
+    if (::lseek(static_cast<int>(this->file_handle_), static_cast<off_t>(size), SEEK_SET) == -1
+        || ::ftruncate(static_cast<int>(this->file_handle_), static_cast<off_t>(size)) != 0) {
+        return MMapError::with_header("truncate file");
+    }
+#endif
+    this->size_ = size;
+    return {};
+}
+
+auto StreamWriter::write_raw(std::span<char const> src) noexcept -> MMapError {
+    for (std::size_t pos = 0; pos != src.size();) {
+        auto const to_write = std::min(src.size() - pos, io_size_max);
+#ifdef _WIN32
+        auto done = DWORD {};
+        if (::WriteFile(reinterpret_cast<HANDLE>(this->file_handle_), src.data() + pos,
+                        static_cast<DWORD>(to_write), &done, nullptr) == FALSE) {
+            return MMapError::with_header("write file");
+        }
+#else
+        auto const done = ::write(static_cast<int>(this->file_handle_), src.data() + pos, to_write);
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return MMapError::with_header("write file");
+        }
+#endif
+        pos += static_cast<std::size_t>(done);
+    }
+    return {};
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+#include "mmap.hpp"
+
+// Where a reader opened with a window gets its views from.
+enum class ReadBackend : std::uint32_t {
+    // window mapping moved along the file, pages come in by faults on first access
+    mmap = 0,
+    // aligned pread into buffers a thread fills while the previous one is in use
+    pread = 1,
+    // pread with O_DIRECT past the page cache, file systems without it get pread and their pages dropped
+    direct = 2,
+};
+
+// Sequential reader for input that cannot be mapped, like pipes, "-" reads stdin.
+struct StreamReader {
+    [[nodiscard]] StreamReader() noexcept;
+    StreamReader(StreamReader const&) = delete;
+    StreamReader& operator=(StreamReader const&) = delete;
+    ~StreamReader() noexcept;
+
+    [[nodiscard]] auto open(std::filesystem::path const& path) noexcept -> MMapError;
+    // file is handed out window size bytes at a time by view instead of read, no copies on the way
+    [[nodiscard]] auto open(std::filesystem::path const& path, std::size_t window_size,
+                            ReadBackend backend = ReadBackend::mmap) noexcept -> MMapError;
+    [[nodiscard]] auto close() noexcept -> MMapError;
+
+    // fills dst unless input ends first, size is what got read, less than dst only at the end
+    // not for readers opened with a window
+    [[nodiscard]] auto read(std::span<char> dst, std::size_t& size) noexcept -> MMapError;
+
+    // next window of a reader opened with one, less only at the end, valid until the next view
+    [[nodiscard]] auto view(std::span<char const>& out) noexcept -> MMapError;
+
+    [[nodiscard]] inline auto is_windowed() const noexcept -> bool {
+        return this->window_size_ != 0;
+    }
+    [[nodiscard]] inline auto window_size() const noexcept -> std::size_t {
+        return this->window_size_;
+    }
+
+private:
+    struct Prefetch;
+
+    std::intptr_t file_handle_ = {};
+    MMapWindow<char const> window_ = {};
+    std::uint64_t window_pos_ = {};
+    std::size_t window_size_ = {};
+    std::unique_ptr<Prefetch> prefetch_;
+    bool is_open_ = {};
+    bool is_std_ = {};
+};
+
+// Buffered sequential writer, output goes out as it is produced instead of into a mapping sized for the worst case.
+// "-" writes to stdout, stdout itself then goes to stderr so nothing else printed ends up in the output.
+struct StreamWriter {
+    [[nodiscard]] StreamWriter() noexcept = default;
+    StreamWriter(StreamWriter const&) = delete;
+    StreamWriter& operator=(StreamWriter const&) = delete;
+    ~StreamWriter() noexcept;
+
+    // creates or truncates the file
+    [[nodiscard]] auto create(std::filesystem::path const& path) noexcept -> MMapError;
+    // flushes the buffer first
+    [[nodiscard]] auto close() noexcept -> MMapError;
+
+    [[nodiscard]] auto write(std::span<char const> src) noexcept -> MMapError;
+    [[nodiscard]] auto flush() noexcept -> MMapError;
+
+    // room for at least size bytes at the end of the buffer to produce output in place,
+    // commit then appends what actually got produced
+    [[nodiscard]] auto reserve(std::size_t size) noexcept -> std::span<char>;
+    [[nodiscard]] auto commit(std::size_t size) noexcept -> MMapError;
+
+    // drops everything past size, output written out already has to be a file that can be cut
+    [[nodiscard]] auto truncate(std::uint64_t size) noexcept -> MMapError;
+
+    // everything written so far, buffered or not
+    [[nodiscard]] inline auto size() const noexcept -> std::uint64_t {
+        return this->size_;
+    }
+
+private:
+    std::intptr_t file_handle_ = {};
+    std::uint64_t size_ = {};
+    std::vector<char> buffer_ = {};
+    std::size_t buffer_used_ = {};
+    bool is_open_ = {};
+
+    [[nodiscard]] auto write_raw(std::span<char const> src) noexcept -> MMapError;
+};
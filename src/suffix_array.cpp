@@ -0,0 +1,308 @@
+#include "suffix_array.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+
+// two bytes pick the bucket, four more the initial sort key, rounds then double the sorted prefix
+constexpr std::size_t bucket_count = std::size_t { 1 } << 16;
+constexpr std::size_t prefix_size = 6;
+// comparing beyond this while searching only slows down long matches, they get extended afterwards
+constexpr std::size_t search_size_max = std::size_t { 1 } << 12;
+// a new offset costs a few bytes, a repeated one about one
+constexpr std::size_t match_size_min = 12;
+constexpr std::size_t rep_size_min = 4;
+constexpr std::size_t match_cost = 4;
+constexpr std::size_t rep_cost = 1;
+
+// call job(worker, index) for every index on up to threads workers
+template <typename Job>
+static auto parallel_for(std::size_t count, unsigned threads, Job const& job) noexcept -> void {
+    auto const worker_count = std::min(std::size_t { std::max(threads, 1u) }, count);
+    if (worker_count <= 1) {
+        for (std::size_t i = 0; i != count; ++i) {
+            job(std::size_t {}, i);
+        }
+        return;
+    }
+    auto next = std::atomic<std::size_t> {};
+    auto workers = std::vector<std::thread>();
+    for (std::size_t w = 0; w != worker_count; ++w) {
+        workers.emplace_back([&, w] () noexcept {
+            for (auto i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+                job(w, i);
+            }
+        });
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
+
+// sort parts on every thread, then merge neighbouring runs pairwise until one is left
+template <typename T, typename Compare>
+static auto parallel_sort(T* first, T* last, Compare const& compare, unsigned threads) noexcept -> void {
+    auto const size = static_cast<std::size_t>(last - first);
+    auto const parts = std::clamp(size >> 16, std::size_t { 1 }, std::size_t { std::max(threads, 1u) });
+    auto bounds = std::vector<T*>(parts + 1);
+    for (std::size_t i = 0; i != parts + 1; ++i) {
+        bounds[i] = first + size * i / parts;
+    }
+    parallel_for(parts, threads, [&] (std::size_t, std::size_t i) noexcept {
+        std::sort(bounds[i], bounds[i + 1], compare);
+    });
+    for (std::size_t width = 1; width < parts; width *= 2) {
+        parallel_for((parts + 2 * width - 1) / (2 * width), threads, [&] (std::size_t, std::size_t i) noexcept {
+            auto const begin = 2 * width * i;
+            std::inplace_merge(bounds[begin], bounds[std::min(begin + width, parts)], bounds[std::min(begin + 2 * width, parts)], compare);
+        });
+    }
+}
+
+static auto common_size(char const* lhs, char const* rhs, std::size_t size) noexcept -> std::size_t {
+    return static_cast<std::size_t>(std::mismatch(lhs, lhs + size, rhs).first - lhs);
+}
+
+auto SuffixArray::build(std::span<char const> data, unsigned threads) noexcept -> SuffixArray {
+    struct Group {
+        std::size_t start;
+        std::size_t size;
+    };
+    // sort key copied next to its suffix, sorting then reads neither the data nor the ranks
+    struct Keyed {
+        std::uint64_t key;
+        std::uint32_t length;
+        std::uint32_t pos;
+    };
+    auto result = SuffixArray {};
+    auto const size = data.size();
+    auto const bytes = reinterpret_cast<unsigned char const*>(data.data());
+    auto const workers = std::max(threads, 1u);
+    result.data_ = data;
+    result.suffixes_.resize(size);
+    auto& suffixes = result.suffixes_;
+
+    // first bytes in big endian order, zero padded past the end
+    auto const bucket = [&] (std::size_t pos) noexcept {
+        return (std::size_t { bytes[pos] } << 8) | (pos + 1 < size ? bytes[pos + 1] : 0u);
+    };
+    // padding is no byte, a suffix ending within the prefix sorts before longer ones with the same bytes
+    auto const prefix_key = [&] (std::uint32_t pos) noexcept {
+        auto key = std::uint32_t {};
+        for (std::size_t i = 2; i != prefix_size; ++i) {
+            key = (key << 8) | (pos + i < size ? bytes[pos + i] : 0u);
+        }
+        return std::pair { std::uint64_t { key }, static_cast<std::uint32_t>(std::min(size - pos, prefix_size)) };
+    };
+
+    // counting sort by the first two bytes, every worker counts and scatters its own part of the data
+    // keys are picked up while the data streams by, ranks hold them until the first ranking
+    auto counts = std::vector<std::vector<std::size_t>>(workers, std::vector<std::size_t>(bucket_count));
+    auto const part_pos = [&] (std::size_t part) noexcept {
+        return size * part / workers;
+    };
+    parallel_for(workers, threads, [&] (std::size_t, std::size_t part) noexcept {
+        for (auto pos = part_pos(part); pos != part_pos(part + 1); ++pos) {
+            ++counts[part][bucket(pos)];
+        }
+    });
+    auto groups = std::vector<Group>();
+    auto offset = std::size_t {};
+    for (std::size_t b = 0; b != bucket_count; ++b) {
+        auto const start = offset;
+        for (auto& part_counts : counts) {
+            offset += std::exchange(part_counts[b], offset);
+        }
+        if (offset != start) {
+            groups.push_back({ start, offset - start });
+        }
+    }
+    auto ranks = std::vector<std::uint32_t>(size);
+    parallel_for(workers, threads, [&] (std::size_t, std::size_t part) noexcept {
+        for (auto pos = part_pos(part); pos != part_pos(part + 1); ++pos) {
+            auto const slot = counts[part][bucket(pos)]++;
+            suffixes[slot] = static_cast<std::uint32_t>(pos);
+            ranks[slot] = static_cast<std::uint32_t>(prefix_key(static_cast<std::uint32_t>(pos)).first);
+        }
+    });
+    counts.clear();
+
+    // suffixes that share a sorted prefix form a group, rank of a suffix is where its group starts
+    // heads marks where a group starts in the sorted order, set while sorting and read while ranking
+    // so no round reads a rank another thread writes
+    auto heads = std::vector<std::uint8_t>(size);
+    auto scratch = std::vector<std::vector<Keyed>>(workers);
+    // large groups are sorted in place by all threads, the rest get their keys copied on one thread
+    auto const large = std::max(size / (4 * workers), std::size_t { 1 } << 16);
+    // key_at gives the key of the suffix at a sorted index, cheaper than key_of its position
+    auto const sort_groups = [&] (auto const& key_of, auto const& key_at) noexcept {
+        auto const key_less = [&] (std::uint32_t lhs, std::uint32_t rhs) noexcept {
+            return key_of(lhs) < key_of(rhs);
+        };
+        for (auto const& group : groups) {
+            if (group.size >= large) {
+                auto const first = suffixes.data() + group.start;
+                parallel_sort(first, first + group.size, key_less, threads);
+                for (std::size_t i = 1; i != group.size; ++i) {
+                    heads[group.start + i] = key_of(first[i - 1]) != key_of(first[i]);
+                }
+            }
+        }
+        parallel_for(groups.size(), threads, [&] (std::size_t worker, std::size_t index) noexcept {
+            auto const group = groups[index];
+            if (group.size < 2 || group.size >= large) {
+                return;
+            }
+            auto& keyed = scratch[worker];
+            keyed.clear();
+            for (auto i = group.start; i != group.start + group.size; ++i) {
+                auto const [key, length] = key_at(i);
+                keyed.push_back({ key, length, suffixes[i] });
+            }
+            std::sort(keyed.begin(), keyed.end(), [] (Keyed const& lhs, Keyed const& rhs) noexcept {
+                return lhs.key != rhs.key ? lhs.key < rhs.key : lhs.length < rhs.length;
+            });
+            for (std::size_t i = 0; i != group.size; ++i) {
+                suffixes[group.start + i] = keyed[i].pos;
+                heads[group.start + i] = i != 0 && (keyed[i].key != keyed[i - 1].key || keyed[i].length != keyed[i - 1].length);
+            }
+        });
+    };
+    auto const rank_groups = [&] () noexcept {
+        auto found = std::vector<std::vector<Group>>(workers);
+        parallel_for(groups.size(), threads, [&] (std::size_t worker, std::size_t index) noexcept {
+            auto const group = groups[index];
+            auto head = group.start;
+            for (auto i = group.start; i != group.start + group.size; ++i) {
+                if (heads[i] && i != head) {
+                    if (i - head > 1) {
+                        found[worker].push_back({ head, i - head });
+                    }
+                    head = i;
+                }
+                ranks[suffixes[i]] = static_cast<std::uint32_t>(head);
+            }
+            if (group.start + group.size - head > 1) {
+                found[worker].push_back({ head, group.start + group.size - head });
+            }
+        });
+        groups.clear();
+        for (auto const& worker_groups : found) {
+            groups.insert(groups.end(), worker_groups.begin(), worker_groups.end());
+        }
+    };
+
+    sort_groups(prefix_key, [&] (std::size_t i) noexcept {
+        return std::pair { std::uint64_t { ranks[i] }, static_cast<std::uint32_t>(std::min(size - suffixes[i], prefix_size)) };
+    });
+    rank_groups();
+
+    // suffixes running out sort first, everything else by the group of the suffix h bytes further
+    for (auto h = prefix_size; !groups.empty(); h *= 2) {
+        auto const next = [&] (std::uint32_t pos) noexcept {
+            return std::pair { pos + h < size ? std::uint64_t { ranks[pos + h] } + 1 : 0, std::uint32_t {} };
+        };
+        sort_groups(next, [&] (std::size_t i) noexcept {
+            return next(suffixes[i]);
+        });
+        rank_groups();
+    }
+    return result;
+}
+
+auto SuffixArray::longest_match(char const* text, std::size_t size) const noexcept -> Match {
+    auto const data = this->data_.data();
+    auto const data_size = this->data_.size();
+    auto const search_size = std::min(size, search_size_max);
+    // first suffix not below text, common prefix with both bounds is known not to need comparing again
+    auto left = std::size_t {};
+    auto right = this->suffixes_.size();
+    auto common_left = std::size_t {};
+    auto common_right = std::size_t {};
+    while (left < right) {
+        auto const mid = left + (right - left) / 2;
+        auto const pos = this->suffixes_[mid];
+        auto const limit = std::min(search_size, data_size - pos);
+        auto const skip = std::min({ common_left, common_right, limit });
+        auto const common = skip + common_size(text + skip, data + pos + skip, limit - skip);
+        auto const below = common != search_size
+            && (common == data_size - pos || static_cast<unsigned char>(data[pos + common]) < static_cast<unsigned char>(text[common]));
+        if (below) {
+            left = mid + 1;
+            common_left = common;
+        } else {
+            right = mid;
+            common_right = common;
+        }
+    }
+    // longest match is next to where text would be inserted
+    auto best = Match {};
+    for (auto const index : { left - 1, left }) {
+        if (index >= this->suffixes_.size()) {
+            continue;
+        }
+        auto const pos = this->suffixes_[index];
+        auto const length = common_size(text, data + pos, std::min(size, data_size - pos));
+        if (length > best.length) {
+            best = { pos, length };
+        }
+    }
+    return best;
+}
+
+auto SuffixArray::collect(char const* src, std::size_t src_size, std::size_t region_pos, SequenceList& out) const noexcept -> void {
+    struct Candidate {
+        std::uint64_t offset;
+        std::uint64_t length;
+        std::uint64_t gain;
+    };
+    auto const data = this->data_.data();
+    auto const data_size = this->data_.size();
+    auto last_offset = std::uint64_t {};
+    // offsets are distances back in [old file][new file]
+    auto const best_at = [&] (std::size_t pos) noexcept {
+        auto best = Candidate {};
+        auto const virtual_pos = data_size + region_pos + pos;
+        if (last_offset != 0 && last_offset <= virtual_pos && virtual_pos - last_offset < data_size) {
+            auto const old_pos = virtual_pos - last_offset;
+            auto const length = common_size(src + pos, data + old_pos, std::min(src_size - pos, data_size - old_pos));
+            if (length >= rep_size_min) {
+                best = { last_offset, length, length - rep_cost };
+            }
+        }
+        auto const match = this->longest_match(src + pos, src_size - pos);
+        if (match.length >= match_size_min && match.length - match_cost > best.gain) {
+            best = { virtual_pos - match.pos, match.length, match.length - match_cost };
+        }
+        return best;
+    };
+
+    auto literals = std::size_t {};
+    auto pos = std::size_t {};
+    auto current = src_size != 0 ? best_at(0) : Candidate {};
+    while (pos < src_size) {
+        if (current.gain == 0) {
+            ++literals;
+            ++pos;
+            current = pos < src_size ? best_at(pos) : Candidate {};
+            continue;
+        }
+        // a better match starting one byte later is worth the literal
+        if (pos + 1 < src_size && current.length < search_size_max) {
+            auto const next = best_at(pos + 1);
+            if (next.gain > current.gain + 1) {
+                ++literals;
+                ++pos;
+                current = next;
+                continue;
+            }
+        }
+        out.add_literals(literals);
+        out.add_match(static_cast<std::uint32_t>(current.offset), current.length);
+        literals = 0;
+        last_offset = current.offset;
+        pos += current.length;
+        current = pos < src_size ? best_at(pos) : Candidate {};
+    }
+    out.add_literals(literals);
+}
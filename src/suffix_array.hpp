@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "sequences.hpp"
+
+// Sorted suffixes of the old file, finds the longest match of any string in it.
+// Needs 4 bytes per old byte, 9 while building, so old file has to stay below 4GB.
+struct SuffixArray {
+    struct Match {
+        std::uint64_t pos;
+        std::uint64_t length;
+    };
+
+    // Bucketed by the first bytes, then prefix doubling where every round sorts the groups still sharing a prefix on all threads.
+    [[nodiscard]] static auto build(std::span<char const> data, unsigned threads) noexcept -> SuffixArray;
+
+    [[nodiscard]] auto longest_match(char const* text, std::size_t size) const noexcept -> Match;
+
+    // Parses one region of the new file into matches against the old file and literals, with one step lazy matching.
+    // Continuing the previous match after a small change is preferred, zstd codes that as a repcode.
+    auto collect(char const* src, std::size_t src_size, std::size_t region_pos, SequenceList& out) const noexcept -> void;
+
+private:
+    std::span<char const> data_ = {};
+    std::vector<std::uint32_t> suffixes_ = {};
+};
@@ -1,8 +1,27 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
 #include <bit>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "affix.hpp"
+#include "branch_filter.hpp"
+#include "byte_diff.hpp"
+#include "chunks.hpp"
+#include "common/zstd_errors.h"
+#include "dict_index.hpp"
 #include "mmap.hpp"
+#include "records.hpp"
+#include "sequences.hpp"
+#include "stream.hpp"
+#include "suffix_array.hpp"
 #include "zstd.h"
 
 static int exit_mmap_error(char const* from, MMapError const& error) noexcept {
@@ -16,16 +35,83 @@ static int exit_zstd_error(char const* from, std::size_t error) noexcept {
     return EXIT_FAILURE;
 }
 
+// diff did not come out smaller than plain compression of new file and output could not be replaced by that
+constexpr int exit_no_payoff = 2;
+
 static int exit_other_error(char const* msg) {
     ::fprintf(stderr, "Failed to %s\n", msg);
     return EXIT_FAILURE;
 }
 
+static std::size_t zstd_error(ZSTD_ErrorCode code) noexcept {
+    return static_cast<std::size_t>(-static_cast<std::ptrdiff_t>(code));
+}
+
 static int exit_bad_args() noexcept {
-    ::fprintf(stderr, "zstdiff <in old file> <in new file> <out diff file> <opt compress level>\n");
+    ::fprintf(stderr, "zstdiff [-T<threads>] [--single-frame] [--copy-chunks] [--suffix-array] [--byte-diff] [--branch-filter] [--trim] [--time-budget=<seconds>] [--adaptive] [--give-up] [--long] [--index=<file>] [--windowed[=<window MB>]] [--populate] [--mlock] [--huge-pages] [--map-window=<MB>] [--read=mmap|pread|direct] <in old file> <in new file or - for stdin> <out diff file> <opt compress level>\n");
+    ::fprintf(stderr, "zstdiff --estimate [-T<threads>] [--trim] <in old file> <in new file>\n");
+    ::fprintf(stderr, "zstdiff --batch [-T<threads>] [--index=<file>] <in old file> <in new file> <out diff file> [<in new file> <out diff file>...] <opt compress level>\n");
+    ::fprintf(stderr, "zstdiff --fan-in [-T<threads>] <in new file> <in old file> <out diff file> [<in old file> <out diff file>...] <opt compress level>\n");
     return EXIT_FAILURE;
 }
 
+struct DiffOptions {
+    int level = 0;
+    // 0 or 1 is a single frame, more compresses segments as separate frames in parallel
+    // with --long only indexing of the old file runs in parallel
+    unsigned threads = 0;
+    // segments are only searched in parallel, output stays one standard frame plain zstd decodes with old file as dict
+    bool single_frame = false;
+    // old file as prefix searched by long distance matcher instead of dict tables
+    bool long_distance = false;
+    // sidecar with dict tables of old file, reused when it matches and written otherwise
+    char const* index_path = nullptr;
+    // one old file against many new/diff pairs, threads then compress whole targets concurrently
+    bool batch = false;
+    // predicts diff size and time per level instead of diffing
+    bool estimate = false;
+    // one new file against many old/diff pairs, threads then handle whole bases concurrently
+    bool fan_in = false;
+    // identical chunks of old and new file are copied without match search, implies single frame
+    bool copy_chunks = false;
+    // longest matches from a suffix array of old file instead of dict search, implies single frame
+    bool suffix_array = false;
+    // approximate matches become a bytewise difference to old file ahead of the dict search
+    bool byte_diff = false;
+    // relative branches in code sections of old and new file become absolute before diffing
+    bool branch_filter = false;
+    // shared start and end become a record only zstpatch knows, plain zstd no longer decodes the diff
+    bool trim = false;
+    // seconds the whole diff may take, level argument becomes the highest level segments start with
+    double time_budget = 0;
+    // segments mostly copied from old file get a cheap level, the others the level argument
+    bool adaptive = false;
+    // diff gets compared against plain compression of new file while it goes and is replaced by that
+    // when it does not pay off, only with one dict over all of old file
+    bool give_up = false;
+    // segments of new file get their own frame with only the matching old region as dict,
+    // picked automatically when old file is too large for a single window
+    bool windowed = false;
+    std::uint64_t window_max = std::uint64_t { 512 } << 20;
+    // old file is read once for the dict and then again wherever matches point, keeping it in memory pays off
+    MMapOptions old_map = {};
+    // new file is mapped this many bytes at a time and goes the way of a stream, segments split the window
+    // between threads, so their frames and what zstpatch has to keep of them stay that small as well
+    std::size_t map_window = 0;
+    // windows of new file can come from reads a thread does ahead instead, nothing faults in then,
+    // direct reads also leave the page cache alone
+    ReadBackend new_read = ReadBackend::mmap;
+};
+
+// dict zstd still keeps in reach from every position of a frame
+constexpr auto dict_size_max = (std::uint64_t { 1 } << ZSTD_WINDOWLOG_MAX) - 1024;
+
+constexpr auto frame_params = ZSTD_frameParameters {
+    .contentSizeFlag = 1,
+    .checksumFlag = 1,
+    .noDictIDFlag = 0,
+};
+
 static void print_progress(std::size_t done, std::size_t total) {
     constexpr char const* const unit_name[] = {
         "B", "KB", "MB", "GB",
@@ -42,107 +128,2223 @@ static void print_progress(std::size_t done, std::size_t total) {
              unit_name[unit_index]);
 }
 
-static int zst_diff(std::filesystem::path const& path_old,
-                    std::filesystem::path const& path_new,
-                    std::filesystem::path const& path_diff,
-                    int level) noexcept {
-    auto map_old = MMap<char const>();
-    ::printf("Maping old file...\n");
-    if (auto error = map_old.open(path_old)) {
-        return exit_mmap_error("open old file", error);
+// compress src into a single frame block by block, dict is only ever referenced(no copies)
+template <typename OnBlock>
+static std::size_t compress_frame(ZSTD_CCtx* ctx, ZSTD_CDict const* dict,
+                                  char const* src, std::size_t src_size,
+                                  char* dst, std::size_t dst_size,
+                                  OnBlock&& on_block) noexcept {
+    if (auto const error = ZSTD_compressBegin_usingCDict_advanced(ctx, dict, frame_params, src_size);
+            ZSTD_isError(error)) {
+        return error;
     }
+    auto const block_size = ZSTD_getBlockSize(ctx);
+    std::size_t in_pos = 0;
+    std::size_t out_pos = 0;
+    do {
+        auto const in_left = src_size - in_pos;
+        auto const to_read = std::min(block_size, in_left);
+        auto result = std::size_t{};
+        if (in_left <= block_size) {
+            result = ZSTD_compressEnd(ctx, dst + out_pos, dst_size - out_pos, src + in_pos, to_read);
+        } else {
+            result = ZSTD_compressContinue(ctx, dst + out_pos, dst_size - out_pos, src + in_pos, to_read);
+        }
+        if (ZSTD_isError(result)) {
+            return result;
+        }
+        in_pos += to_read;
+        out_pos += result;
+        on_block(in_pos);
+    } while (in_pos != src_size);
+    return out_pos;
+}
 
-    auto map_new = MMap<char const>();
-    ::printf("Maping new file...\n");
-    if (auto error = map_new.open(path_new)) {
-        return exit_mmap_error("open new file", error);
+// same as compress_frame but every block goes to writer as soon as it is compressed
+// returns frame size or zstd error, write errors end up in write_error
+template <typename OnBlock>
+static std::size_t write_frame(ZSTD_CCtx* ctx, ZSTD_CDict const* dict,
+                               char const* src, std::size_t src_size,
+                               StreamWriter& writer, MMapError& write_error,
+                               OnBlock&& on_block) noexcept {
+    if (auto const error = ZSTD_compressBegin_usingCDict_advanced(ctx, dict, frame_params, src_size);
+            ZSTD_isError(error)) {
+        return error;
     }
+    auto const block_size = ZSTD_getBlockSize(ctx);
+    std::size_t in_pos = 0;
+    std::size_t out_pos = 0;
+    do {
+        auto const in_left = src_size - in_pos;
+        auto const to_read = std::min(block_size, in_left);
+        // room for the frame header and checksum too
+        auto const dst = writer.reserve(ZSTD_compressBound(to_read) + ZSTD_FRAMEHEADERSIZE_MAX + 4);
+        auto result = std::size_t{};
+        if (in_left <= block_size) {
+            result = ZSTD_compressEnd(ctx, dst.data(), dst.size(), src + in_pos, to_read);
+        } else {
+            result = ZSTD_compressContinue(ctx, dst.data(), dst.size(), src + in_pos, to_read);
+        }
+        if (ZSTD_isError(result)) {
+            return result;
+        }
+        if ((write_error = writer.commit(result))) {
+            return zstd_error(ZSTD_error_GENERIC);
+        }
+        in_pos += to_read;
+        out_pos += result;
+        on_block(in_pos);
+    } while (in_pos != src_size);
+    return out_pos;
+}
 
-    // create context and set correct params for buffer-less compression(no internal copies)
-    auto const ctx = ZSTD_createCCtx();
-    if (ctx == nullptr) {
-        return exit_other_error("allocate compress context");
+// segments get compressed out of order by several workers, their output goes to writer in order
+// as soon as every segment before it is out, only output finished ahead of a slower segment waits in memory
+struct OrderedWriter {
+    struct Waiting {
+        std::vector<char> data;
+        bool done;
+    };
+
+    StreamWriter& writer;
+    std::mutex mutex = {};
+    std::vector<Waiting> waiting = {};
+    std::size_t next = {};
+    MMapError error = {};
+
+    OrderedWriter(StreamWriter& writer_, std::size_t count) noexcept
+        : writer(writer_), waiting(count) {}
+
+    // returns zstd error once writing failed so remaining jobs get skipped, error holds the cause
+    [[nodiscard]] auto add(std::size_t index, std::span<char const> out) noexcept -> std::size_t {
+        auto const lock = std::lock_guard(this->mutex);
+        if (this->error) {
+            return zstd_error(ZSTD_error_GENERIC);
+        }
+        if (index != this->next) {
+            this->waiting[index] = { std::vector<char>(out.begin(), out.end()), true };
+            return 0;
+        }
+        this->error = this->writer.write(out);
+        for (++this->next; !this->error && this->next != this->waiting.size() && this->waiting[this->next].done;
+             ++this->next) {
+            this->error = this->writer.write(this->waiting[this->next].data);
+            this->waiting[this->next].data = {};
+        }
+        return this->error ? zstd_error(ZSTD_error_GENERIC) : 0;
     }
-    // create and set dict as raw content, by reference(no copies)
-    auto cparams = ZSTD_getCParams(level, map_new.size(), map_old.size());
-    auto const dict_size_plus = static_cast<std::uint64_t>(map_old.size() + 1024);
-    cparams.windowLog = static_cast<unsigned>(64u - std::countl_zero(dict_size_plus) - 1);
-    ::printf("Loading dictionary...\n");
-    auto const dict = ZSTD_createCDict_advanced(map_old.data(), map_old.size(),
-                                                ZSTD_dlm_byRef,
-                                                ZSTD_dct_rawContent,
-                                                cparams,
-                                                {});
-    if (dict == nullptr) {
-        return exit_other_error("create dictionary");
+};
+
+// owns one compress context per worker thread
+struct ContextPool {
+    std::vector<ZSTD_CCtx*> contexts = {};
+
+    ContextPool() noexcept = default;
+    ContextPool(ContextPool const&) = delete;
+    ContextPool& operator=(ContextPool const&) = delete;
+    ~ContextPool() noexcept {
+        for (auto ctx : this->contexts) {
+            ZSTD_freeCCtx(ctx);
+        }
     }
-    if (auto const error = ZSTD_CCtx_refCDict(ctx, dict); ZSTD_isError(error)) {
-        return exit_zstd_error("set refCDict", error);
+
+    // dict is attached instead of copied so every context searches the same shared tables
+    [[nodiscard]] auto create(unsigned count, ZSTD_CDict const* dict, unsigned window_log) noexcept -> int {
+        for (unsigned i = 0; i != count; ++i) {
+            auto const ctx = ZSTD_createCCtx();
+            if (ctx == nullptr) {
+                return exit_other_error("allocate compress context");
+            }
+            this->contexts.push_back(ctx);
+            if (auto const error = ZSTD_CCtx_refCDict(ctx, dict); ZSTD_isError(error)) {
+                return exit_zstd_error("set refCDict", error);
+            }
+            if (auto const error = ZSTD_CCtx_setParameter(ctx, ZSTD_c_forceAttachDict, ZSTD_dictForceAttach);
+                    ZSTD_isError(error)) {
+                return exit_zstd_error("set forceAttachDict", error);
+            }
+            // keep dict reachable for whole job, not just default window of its size
+            if (auto const error = ZSTD_CCtx_setParameter(ctx, ZSTD_c_windowLog, static_cast<int>(window_log));
+                    ZSTD_isError(error)) {
+                return exit_zstd_error("set windowLog", error);
+            }
+        }
+        return EXIT_SUCCESS;
     }
+};
 
-    // create/open diff file and resize it to estimated size
-    auto const size_diff_estimated = ZSTD_compressBound(map_new.size());
-    auto map_diff = MMap<char>();
-    ::printf("Maping diff file...\n");
-    if (auto error = map_diff.create(path_diff, size_diff_estimated)) {
-        return exit_mmap_error("create diff file", error);
+// run job(worker, index) for every index on worker_count threads, prints progress of in_done meanwhile
+// returns first zstd error, remaining jobs are skipped after a failure
+template <typename Job>
+static std::size_t run_jobs(std::size_t worker_count, std::size_t job_count,
+                            std::atomic<std::size_t> const& in_done, std::size_t in_total,
+                            Job const& job) noexcept {
+    auto next_job = std::atomic<std::size_t> {};
+    auto workers_left = std::atomic<std::size_t> { worker_count };
+    auto first_error = std::atomic<std::size_t> {};
+    auto const worker = [&] (std::size_t worker_index) noexcept {
+        while (!first_error.load()) {
+            auto const index = next_job.fetch_add(1);
+            if (index >= job_count) {
+                break;
+            }
+            if (auto const error = job(worker_index, index); ZSTD_isError(error)) {
+                auto expected = std::size_t{};
+                first_error.compare_exchange_strong(expected, error);
+            }
+        }
+        --workers_left;
+    };
+    auto workers = std::vector<std::thread>();
+    for (std::size_t i = 0; i != worker_count; ++i) {
+        workers.emplace_back(worker, i);
+    }
+    while (workers_left.load()) {
+        print_progress(in_done.load(), in_total);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    print_progress(in_done.load(), in_total);
+    return first_error.load();
+}
 
-    // do compression
-    std::size_t in_pos = 0;
-    std::size_t out_pos = 0;
-    ::printf("Compress start...\n");
-    auto const fparams = ZSTD_frameParameters {
-            .contentSizeFlag = 1,
-            .checksumFlag = 1,
-            .noDictIDFlag = 0,
+// split new file into block aligned segments, at most segment_max bytes and at least one per thread
+static std::size_t segment_size_for(std::size_t size, unsigned threads, std::size_t segment_max) noexcept {
+    auto const block_size = std::size_t { ZSTD_BLOCKSIZE_MAX };
+    auto const segment_blocks = (size / threads + block_size - 1) / block_size;
+    return std::clamp(segment_blocks * block_size, block_size, std::max(segment_max, block_size));
+}
+
+// split new file into segments and compress each one as its own frame on a worker thread
+// every worker has its own context but they all share one read-only dict
+static int zst_diff_segments(std::span<char const> new_data,
+                             ZSTD_CDict const* dict,
+                             unsigned window_log,
+                             StreamWriter& writer,
+                             unsigned threads) noexcept {
+    // output of every worker is buffered until it is its turn, more segments keep that small
+    auto const segment_size = segment_size_for(new_data.size(), threads, std::size_t { 64 } << 20);
+    auto const segment_count = std::max((new_data.size() + segment_size - 1) / segment_size, std::size_t { 1 });
+
+    auto pool = ContextPool();
+    if (auto const result = pool.create(threads, dict, window_log)) {
+        return result;
+    }
+    auto buffers = std::vector<std::vector<char>>(pool.contexts.size());
+    auto ordered = OrderedWriter(writer, segment_count);
+
+    ::printf("Compress start with %u threads...\n", threads);
+    auto in_done = std::atomic<std::size_t> {};
+    auto const error = run_jobs(pool.contexts.size(), segment_count, in_done, new_data.size(),
+                                [&] (std::size_t worker, std::size_t index) noexcept {
+        auto const in_pos = index * segment_size;
+        auto const in_size = std::min(segment_size, new_data.size() - in_pos);
+        auto& buffer = buffers[worker];
+        buffer.resize(ZSTD_compressBound(in_size));
+        auto last_pos = std::size_t{};
+        auto const result = compress_frame(pool.contexts[worker], dict,
+                                           new_data.data() + in_pos, in_size,
+                                           buffer.data(), buffer.size(),
+                                           [&] (std::size_t pos) noexcept {
+            in_done += pos - last_pos;
+            last_pos = pos;
+        });
+        return ZSTD_isError(result) ? result : ordered.add(index, { buffer.data(), result });
+    });
+    ::printf("\n");
+    if (ordered.error) {
+        return exit_mmap_error("write diff file", ordered.error);
+    }
+    if (error) {
+        return exit_zstd_error("compress file", error);
+    }
+    return EXIT_SUCCESS;
+}
+
+// find matches for segments of new file in parallel, each worker searches the shared dict or the suffix array
+// then entropy code all of them as one standard frame referencing the whole old file
+// copies of identical chunks go straight into the sequences, only the changed regions between them are searched
+static int zst_diff_single_frame(std::span<char const> old_data,
+                                 std::span<char const> new_data,
+                                 ZSTD_CDict const* dict,
+                                 unsigned window_log,
+                                 std::vector<ChunkCopy> const& copies,
+                                 SuffixArray const* suffixes,
+                                 StreamWriter& writer,
+                                 unsigned threads) noexcept {
+    struct Region {
+        std::size_t pos;
+        std::size_t size;
+        std::size_t old_pos;
+        bool copy;
     };
-    if (auto const error = ZSTD_compressBegin_usingCDict_advanced(ctx, dict, fparams, map_new.size());
-            ZSTD_isError(error)) {
-        return exit_zstd_error("compress begin", error);
+    if (old_data.size() + new_data.size() > sequence_offset_max) {
+        return exit_other_error("fit old and new file into a single frame");
     }
-    auto const block_size = ZSTD_getBlockSize(ctx);
-    while (auto const in_left = map_new.size() - in_pos) {
-        auto const to_read = std::min(block_size, in_left);
+    auto copied = std::size_t{};
+    for (auto const& copy : copies) {
+        copied += copy.size;
+    }
+    // sequence scratch of every worker is proportional to its segment size
+    constexpr auto segment_max = std::size_t { 16 } << 20;
+    auto const segment_size = segment_size_for(new_data.size() - copied, threads, segment_max);
+    auto regions = std::vector<Region>();
+    auto const add_changed = [&] (std::size_t pos, std::size_t end) noexcept {
+        for (; pos < end; pos += segment_size) {
+            regions.push_back({ pos, std::min(segment_size, end - pos), 0, false });
+        }
+    };
+    auto changed_pos = std::size_t{};
+    for (auto const& copy : copies) {
+        add_changed(changed_pos, copy.new_pos);
+        regions.push_back({ copy.new_pos, copy.size, copy.old_pos, true });
+        changed_pos = copy.new_pos + copy.size;
+    }
+    add_changed(changed_pos, new_data.size());
+    if (regions.empty()) {
+        regions.push_back({ 0, 0, 0, false });
+    }
+    if (!copies.empty()) {
+        ::printf("Copied %llu of %llu bytes from identical chunks...\n",
+                 static_cast<unsigned long long>(copied),
+                 static_cast<unsigned long long>(new_data.size()));
+    }
+
+    // suffix array search needs no context, one is left for entropy coding
+    auto pool = ContextPool();
+    if (auto const result = pool.create(suffixes ? 1 : threads, dict, window_log)) {
+        return result;
+    }
+    auto generators = std::vector<SequenceGenerator>(pool.contexts.size());
+
+    ::printf("Match start with %u threads...\n", threads);
+    auto segments = std::vector<SequenceList>(regions.size());
+    auto in_done = std::atomic<std::size_t> {};
+    auto const error = run_jobs(threads, regions.size(), in_done, new_data.size(),
+                                [&] (std::size_t worker, std::size_t index) noexcept {
+        auto const& region = regions[index];
         auto result = std::size_t{};
-        if (in_left <= block_size) {
-            result = ZSTD_compressEnd(ctx,
-                                      map_diff.data() + out_pos, map_diff.size() - out_pos,
-                                      map_new.data() + in_pos, to_read);
+        if (region.copy) {
+            // distance back in [old file][new file]
+            segments[index].add_match(static_cast<std::uint32_t>(old_data.size() + region.pos - region.old_pos), region.size);
+        } else if (suffixes) {
+            suffixes->collect(new_data.data() + region.pos, region.size, region.pos, segments[index]);
         } else {
-            result = ZSTD_compressContinue(ctx,
-                                           map_diff.data() + out_pos, map_diff.size() - out_pos,
-                                           map_new.data() + in_pos, to_read);
+            result = generators[worker].generate(pool.contexts[worker],
+                                                 new_data.data() + region.pos, region.size, region.pos,
+                                                 segments[index]);
         }
-        if (ZSTD_isError(result)) {
+        in_done += region.size;
+        return result;
+    });
+    if (error) {
+        ::printf("\n");
+        return exit_zstd_error("find matches", error);
+    }
+    generators.clear();
+
+    auto sequences = SequenceList();
+    for (auto& segment : segments) {
+        sequences.append(static_cast<SequenceList&&>(segment));
+    }
+
+    // sequences only turn into blocks once all of them are known, the frame is produced in one piece
+    ::printf("\nCompress start...\n");
+    auto const out = writer.reserve(ZSTD_compressBound(new_data.size()));
+    auto const out_size = compress_sequences(pool.contexts.front(), sequences,
+                                             new_data.data(), new_data.size(),
+                                             out.data(), out.size());
+    if (ZSTD_isError(out_size)) {
+        return exit_zstd_error("compress file", out_size);
+    }
+    if (auto error = writer.commit(out_size)) {
+        return exit_mmap_error("write diff file", error);
+    }
+    return EXIT_SUCCESS;
+}
+
+static std::size_t set_parameters(ZSTD_CCtx* ctx,
+                                  std::initializer_list<std::pair<ZSTD_cParameter, int>> params) noexcept {
+    for (auto const& [param, value] : params) {
+        if (auto const error = ZSTD_CCtx_setParameter(ctx, param, value); ZSTD_isError(error)) {
+            return error;
+        }
+    }
+    return 0;
+}
+
+// count of threads as a value of param, within the bounds zstd takes for it
+static int clamp_workers(ZSTD_cParameter param, unsigned threads) noexcept {
+    auto const bounds = ZSTD_cParam_getBounds(param);
+    if (ZSTD_isError(bounds.error)) {
+        return 0;
+    }
+    return static_cast<int>(std::clamp<std::int64_t>(threads, bounds.lowerBound, bounds.upperBound));
+}
+
+// old file is referenced as prefix(no copies) and searched by the long distance matcher,
+// window covers both files so far away moved blocks stay reachable from anywhere in new file
+static int zst_diff_long(std::span<char const> old_data,
+                         std::span<char const> new_data,
+                         StreamWriter& writer,
+                         int level,
+                         unsigned threads) noexcept {
+    auto const ctx = ZSTD_createCCtx();
+    if (ctx == nullptr) {
+        return exit_other_error("allocate compress context");
+    }
+    auto const history_size = static_cast<std::uint64_t>(old_data.size() + new_data.size());
+    auto const window_log = std::clamp(static_cast<int>(std::bit_width(history_size)),
+                                       ZSTD_WINDOWLOG_MIN,
+                                       ZSTD_WINDOWLOG_MAX);
+    // matches cannot reach back further than the window, the start of old file is lost to the end of new file
+    if (history_size > (std::uint64_t { 1 } << window_log)) {
+        ::printf("Window is capped at %llu MB, old file further back than that is out of reach...\n",
+                 static_cast<unsigned long long>((std::uint64_t { 1 } << window_log) >> 20));
+    }
+    // denser table with deeper buckets than zstd defaults, delta wants shorter moved blocks too
+    auto const ldm_hash_log = std::clamp(window_log - 4, ZSTD_LDM_HASHLOG_MIN, ZSTD_LDM_HASHLOG_MAX);
+    if (auto const error = set_parameters(ctx, {
+            { ZSTD_c_compressionLevel, level },
+            { ZSTD_c_windowLog, window_log },
+            { ZSTD_c_enableLongDistanceMatching, 1 },
+            { ZSTD_c_ldmHashLog, ldm_hash_log },
+            { ZSTD_c_ldmMinMatch, 32 },
+            { ZSTD_c_ldmBucketSizeLog, 4 },
+            { ZSTD_c_checksumFlag, 1 },
+            // long distance table over the prefix gets filled in parallel, same table as serial
+            { ZSTD_c_dictLoadWorkers, clamp_workers(ZSTD_c_dictLoadWorkers, threads) },
+            // compress straight from our mapping
+            { ZSTD_c_stableInBuffer, 1 },
+        }); ZSTD_isError(error)) {
+        ZSTD_freeCCtx(ctx);
+        return exit_zstd_error("set long distance parameters", error);
+    }
+    if (auto const error = ZSTD_CCtx_refPrefix_advanced(ctx, old_data.data(), old_data.size(), ZSTD_dct_rawContent);
+            ZSTD_isError(error)) {
+        ZSTD_freeCCtx(ctx);
+        return exit_zstd_error("set refPrefix", error);
+    }
+    if (auto const error = ZSTD_CCtx_setPledgedSrcSize(ctx, new_data.size()); ZSTD_isError(error)) {
+        ZSTD_freeCCtx(ctx);
+        return exit_zstd_error("set pledged size", error);
+    }
+
+    // prefix gets indexed by the first call, stable input means whole file goes in one call
+    // and every call returns once its piece of output is full
+    ::printf("Compress start with long distance matching...\n");
+    auto in = ZSTD_inBuffer { new_data.data(), new_data.size(), 0 };
+    for (;;) {
+        auto const dst = writer.reserve(ZSTD_CStreamOutSize());
+        auto out = ZSTD_outBuffer { dst.data(), dst.size(), 0 };
+        auto const remaining = ZSTD_compressStream2(ctx, &out, &in, ZSTD_e_end);
+        if (ZSTD_isError(remaining)) {
             ZSTD_freeCCtx(ctx);
-            ZSTD_freeCDict(dict);
-            [[maybe_unused]] auto const unused_ = map_diff.close(0);
             ::printf("\n");
-            return exit_zstd_error("compress file", result);
+            return exit_zstd_error("compress file", remaining);
+        }
+        if (auto error = writer.commit(out.pos)) {
+            ZSTD_freeCCtx(ctx);
+            ::printf("\n");
+            return exit_mmap_error("write diff file", error);
+        }
+        print_progress(in.pos, new_data.size());
+        if (remaining == 0) {
+            break;
         }
-        in_pos += to_read;
-        out_pos += result;
-        print_progress(in_pos, map_new.size());
     }
-    // truncate and close the file
-    ::printf("\nFlush diff file...\n");
-    if (auto error = map_diff.close(out_pos)) {
-        return exit_mmap_error("close diff file", error);
+    ZSTD_freeCCtx(ctx);
+    ::printf("\n");
+    return EXIT_SUCCESS;
+}
+
+// dict over old data as raw content, by reference(no copies), nullptr after reporting failure
+static ZSTD_CDict* create_dict(std::span<char const> old_data,
+                               ZSTD_compressionParameters const& cparams,
+                               unsigned threads) noexcept {
+    auto const dict_params = ZSTD_createCCtxParams();
+    if (dict_params == nullptr) {
+        exit_other_error("allocate dictionary parameters");
+        return nullptr;
     }
-    ::printf("Done!\n");
+    // tables of fast to lazy strategies get filled by all threads, same dict as serial
+    auto const dict_workers = clamp_workers(ZSTD_c_dictLoadWorkers, std::max(threads, 1u));
+    if (auto const error = ZSTD_CCtxParams_init_advanced(dict_params, ZSTD_parameters { cparams, frame_params });
+            ZSTD_isError(error)) {
+        ZSTD_freeCCtxParams(dict_params);
+        exit_zstd_error("set dictionary parameters", error);
+        return nullptr;
+    }
+    if (auto const error = ZSTD_CCtxParams_setParameter(dict_params, ZSTD_c_dictLoadWorkers, dict_workers);
+            ZSTD_isError(error)) {
+        ZSTD_freeCCtxParams(dict_params);
+        exit_zstd_error("set dictionary load workers", error);
+        return nullptr;
+    }
+    // tables get filled front to back, afterwards only matches read it wherever they point
+    advise_access(old_data, MMapAccess::sequential);
+    advise_access(old_data, MMapAccess::willneed);
+    auto const dict = ZSTD_createCDict_advanced2(old_data.data(), old_data.size(),
+                                                 ZSTD_dlm_byRef,
+                                                 ZSTD_dct_rawContent,
+                                                 dict_params,
+                                                 {});
+    ZSTD_freeCCtxParams(dict_params);
+    advise_access(old_data, MMapAccess::random);
+    if (dict == nullptr) {
+        exit_other_error("create dictionary");
+    }
+    return dict;
+}
 
-    // free context and dict structs
+// maps index and creates a dict referencing its tables, nullptr when index is missing or stale
+static ZSTD_CDict* load_dict_index(MMap<char const>& map_index,
+                                   std::filesystem::path const& path_index,
+                                   std::span<char const> old_data,
+                                   std::uint64_t old_hash,
+                                   ZSTD_compressionParameters const& cparams) noexcept {
+    if (map_index.open(path_index)) {
+        return nullptr;
+    }
+    auto const tables = dict_index_tables(map_index.span(), old_data.size(), old_hash, cparams);
+    auto const dict = tables.empty()
+        ? nullptr
+        : ZSTD_createCDict_fromTables(old_data.data(), old_data.size(), tables.data(), tables.size(), {});
+    if (dict == nullptr) {
+        ::printf("Dictionary index is stale, rebuilding...\n");
+        [[maybe_unused]] auto const unused_ = map_index.close();
+        return nullptr;
+    }
+    ::printf("Loaded dictionary index...\n");
+    return dict;
+}
+
+// failing to write the index only costs the next run its speedup, so it is not fatal
+static void save_dict_index(std::filesystem::path const& path_index,
+                            ZSTD_CDict const* dict,
+                            std::uint64_t old_size,
+                            std::uint64_t old_hash,
+                            ZSTD_compressionParameters const& cparams) noexcept {
+    auto const tables_size = ZSTD_sizeof_CDictTables(dict);
+    auto map_index = MMap<char>();
+    ::printf("Saving dictionary index...\n");
+    if (auto error = map_index.create(path_index, dict_index_tables_offset + tables_size)) {
+        ::fprintf(stderr, "Skipped index, failed to create index file from %s because %d(%s)\n",
+                  error.header, error.errnum, ::strerror(error.errnum));
+        return;
+    }
+    auto const written = ZSTD_CDict_saveTables(dict, map_index.data() + dict_index_tables_offset, tables_size);
+    if (ZSTD_isError(written)) {
+        ::fprintf(stderr, "Skipped index, failed to save tables because %s\n", ZSTD_getErrorName(written));
+        [[maybe_unused]] auto const unused_ = map_index.close(0);
+        return;
+    }
+    // header goes in last, an interrupted write never looks valid
+    auto const header = dict_index_header(old_size, old_hash, cparams,
+                                          { map_index.data() + dict_index_tables_offset, tables_size });
+    ::memcpy(map_index.data(), &header, sizeof(header));
+    if (auto error = map_index.close()) {
+        ::fprintf(stderr, "Skipped index, failed to close index file from %s because %d(%s)\n",
+                  error.header, error.errnum, ::strerror(error.errnum));
+    }
+}
+
+// window covers whole old file so dict stays reachable from anywhere in new file
+static ZSTD_compressionParameters dict_cparams(int level, std::size_t new_size, std::size_t old_size) noexcept {
+    auto cparams = ZSTD_getCParams(level, new_size, old_size);
+    auto const dict_size_plus = static_cast<std::uint64_t>(old_size + 1024);
+    cparams.windowLog = static_cast<unsigned>(64u - std::countl_zero(dict_size_plus) - 1);
+    return cparams;
+}
+
+// create dict as raw content, or reuse its tables from the index, nullptr after reporting failure
+// map_index keeps referenced tables alive and has to outlive the dict
+static ZSTD_CDict* prepare_dict(MMap<char const>& map_index,
+                                std::span<char const> old_data,
+                                ZSTD_compressionParameters const& cparams,
+                                DiffOptions const& options) noexcept {
+    if (options.index_path == nullptr) {
+        ::printf("Loading dictionary...\n");
+        return create_dict(old_data, cparams, options.threads);
+    }
+    ::printf("Hashing old file...\n");
+    advise_access(old_data, MMapAccess::sequential);
+    auto const old_hash = dict_index_hash(old_data);
+    if (auto const dict = load_dict_index(map_index, options.index_path, old_data, old_hash, cparams)) {
+        advise_access(old_data, MMapAccess::random);
+        return dict;
+    }
+    ::printf("Loading dictionary...\n");
+    auto const dict = create_dict(old_data, cparams, options.threads);
+    if (dict != nullptr) {
+        save_dict_index(options.index_path, dict, old_data.size(), old_hash, cparams);
+    }
+    return dict;
+}
+
+// dict params over the old region of window, for frames holding only its segment
+static ZSTD_compressionParameters window_cparams(int level, SegmentWindow const& window) noexcept {
+    auto cparams = dict_cparams(level, window.new_size, window.old_size);
+    // zstd caps this at the dict size rounded up to a power of two, still enough to reach
+    // the start of the projected old region from the end of the segment
+    cparams.windowLog = static_cast<unsigned>(std::clamp(
+        static_cast<int>(std::bit_width(std::max(window.old_size + window.new_size, std::uint64_t { 2 }) - 1)),
+        ZSTD_WINDOWLOG_MIN, ZSTD_WINDOWLOG_MAX));
+    return cparams;
+}
+
+// compress context that keeps the dict of the window it compressed last, neighbouring segments often share it
+struct WindowContext {
+    ZSTD_CCtx* ctx = {};
+    ZSTD_CDict* dict = {};
+    std::uint64_t old_pos = {};
+    std::uint64_t old_size = {};
+    int level = {};
+
+    WindowContext() noexcept = default;
+    WindowContext(WindowContext const&) = delete;
+    WindowContext& operator=(WindowContext const&) = delete;
+    ~WindowContext() noexcept {
+        ZSTD_freeCCtx(this->ctx);
+        ZSTD_freeCDict(this->dict);
+    }
+
+    // context and dict over the old region of window at level, returns zstd error on failure
+    [[nodiscard]] auto prepare(std::span<char const> old_data, SegmentWindow const& window,
+                               int window_level, unsigned threads) noexcept -> std::size_t {
+        if (this->ctx == nullptr) {
+            if ((this->ctx = ZSTD_createCCtx()) == nullptr) {
+                return zstd_error(ZSTD_error_memory_allocation);
+            }
+            // dict is attached instead of its tables copied for every segment
+            if (auto const error = ZSTD_CCtx_setParameter(this->ctx, ZSTD_c_forceAttachDict, ZSTD_dictForceAttach);
+                    ZSTD_isError(error)) {
+                return error;
+            }
+        }
+        if (this->dict != nullptr && this->old_pos == window.old_pos && this->old_size == window.old_size
+            && this->level == window_level) {
+            return 0;
+        }
+        ZSTD_freeCDict(this->dict);
+        this->dict = create_dict(old_data.subspan(window.old_pos, window.old_size),
+                                 window_cparams(window_level, window), threads);
+        if (this->dict == nullptr) {
+            return zstd_error(ZSTD_error_memory_allocation);
+        }
+        this->old_pos = window.old_pos;
+        this->old_size = window.old_size;
+        this->level = window_level;
+        return 0;
+    }
+};
+
+// align new file against old file by chunk fingerprints, then compress every segment of new file
+// as its own frame with only the old region it matches as dict, so window stays within zstd limits
+// a record in front of every frame tells zstpatch which old region that is
+static int zst_diff_windowed(std::span<char const> old_data,
+                             std::span<char const> new_data,
+                             StreamWriter& writer,
+                             DiffOptions const& options) noexcept {
+    auto const threads = std::max(options.threads, 1u);
+    // dict plus segment stay below the largest window
+    auto const segment_size = std::max(options.window_max / 8, std::uint64_t { ZSTD_BLOCKSIZE_MAX });
+
+    ::printf("Chunking old and new file...\n");
+    auto const old_index = ChunkIndex(chunk_data(old_data, threads));
+    auto const windows = plan_windows(chunk_data(new_data, threads), old_index,
+                                      new_data.size(), old_data.size(),
+                                      segment_size, options.window_max);
+
+    // spare threads help indexing when there are fewer segments than threads
+    auto const worker_count = std::min(std::size_t { threads }, windows.size());
+    auto const dict_threads = static_cast<unsigned>(threads / worker_count);
+    auto contexts = std::vector<WindowContext>(worker_count);
+    auto buffers = std::vector<std::vector<char>>(worker_count);
+    auto ordered = OrderedWriter(writer, windows.size());
+
+    ::printf("Compress start of %zu segments with %zu threads...\n", windows.size(), worker_count);
+    auto in_done = std::atomic<std::size_t> {};
+    auto const error = run_jobs(worker_count, windows.size(), in_done, new_data.size(),
+                                [&] (std::size_t worker, std::size_t index) noexcept {
+        auto& context = contexts[worker];
+        auto const& window = windows[index];
+        if (auto const error = context.prepare(old_data, window, options.level, dict_threads); ZSTD_isError(error)) {
+            return error;
+        }
+        auto& buffer = buffers[worker];
+        buffer.resize(dict_window_record_size + ZSTD_compressBound(window.new_size));
+        auto const record_size = write_dict_window(buffer.data(), { window.old_pos, window.old_size });
+        auto last_pos = std::size_t{};
+        auto const result = compress_frame(context.ctx, context.dict,
+                                           new_data.data() + window.new_pos, window.new_size,
+                                           buffer.data() + record_size, buffer.size() - record_size,
+                                           [&] (std::size_t in_pos) noexcept {
+            in_done += in_pos - last_pos;
+            last_pos = in_pos;
+        });
+        // records and frames are independent so they are simply concatenated
+        return ZSTD_isError(result) ? result : ordered.add(index, { buffer.data(), record_size + result });
+    });
+    ::printf("\n");
+    if (ordered.error) {
+        return exit_mmap_error("write diff file", ordered.error);
+    }
+    if (error) {
+        return exit_zstd_error("compress file", error);
+    }
+    return EXIT_SUCCESS;
+}
+
+// align new file against old file bsdiff style and replace every aligned extent by new minus old,
+// code that only moved addresses around turns into runs of zeros between the few changed bytes
+// a record in front of the frame tells zstpatch which extents to add old bytes back to
+static int zst_diff_byte_diff(std::span<char const> old_data,
+                              std::span<char const> new_data,
+                              StreamWriter& writer,
+                              DiffOptions const& options) noexcept {
+    if (old_data.size() > dict_size_max) {
+        return exit_other_error("fit old file into a single window");
+    }
+    auto const threads = std::max(options.threads, 1u);
+    auto extents = std::vector<DiffExtent>();
+    {
+        ::printf("Sorting old file suffixes with %u threads...\n", threads);
+        auto const suffixes = SuffixArray::build(old_data, threads);
+        ::printf("Aligning new file...\n");
+        extents = find_diff_extents(suffixes, old_data, new_data, threads);
+    }
+    auto aligned = std::uint64_t {};
+    for (auto const& extent : extents) {
+        aligned += extent.size;
+    }
+    ::printf("Aligned %llu of %llu bytes in %zu extents...\n",
+             static_cast<unsigned long long>(aligned),
+             static_cast<unsigned long long>(new_data.size()),
+             extents.size());
+    auto transformed = std::vector<char>(new_data.size());
+    subtract_extents(old_data, new_data, extents, transformed.data());
+
+    // bytes outside of extents are still searched in the old file
+    auto const cparams = dict_cparams(options.level, new_data.size(), old_data.size());
+    auto map_index = MMap<char const>();
+    auto const dict = prepare_dict(map_index, old_data, cparams, options);
+    if (dict == nullptr) {
+        return EXIT_FAILURE;
+    }
+    auto const ctx = ZSTD_createCCtx();
+    if (ctx == nullptr) {
+        ZSTD_freeCDict(dict);
+        return exit_other_error("allocate compress context");
+    }
+
+    auto const record_bound = byte_diff_record_bound(extents.size());
+    auto const record_size = write_byte_diff(writer.reserve(record_bound).data(), record_bound, extents);
+    if (ZSTD_isError(record_size)) {
+        ZSTD_freeCCtx(ctx);
+        ZSTD_freeCDict(dict);
+        return exit_zstd_error("write extents", record_size);
+    }
+    if (auto error = writer.commit(record_size)) {
+        ZSTD_freeCCtx(ctx);
+        ZSTD_freeCDict(dict);
+        return exit_mmap_error("write diff file", error);
+    }
+
+    ::printf("Compress start...\n");
+    auto write_error = MMapError {};
+    auto const out_size = write_frame(ctx, dict,
+                                      transformed.data(), transformed.size(),
+                                      writer, write_error,
+                                      [&] (std::size_t in_pos) noexcept {
+        print_progress(in_pos, transformed.size());
+    });
     ZSTD_freeCCtx(ctx);
     ZSTD_freeCDict(dict);
+    ::printf("\n");
+    if (write_error) {
+        return exit_mmap_error("write diff file", write_error);
+    }
+    if (ZSTD_isError(out_size)) {
+        return exit_zstd_error("compress file", out_size);
+    }
+    return EXIT_SUCCESS;
+}
+
+// rough single thread speed of every level relative to each other, index is the level
+// only ratios matter, they pick the level that should be fast enough before it gets measured itself
+constexpr double level_speed[] = {
+    0, 510, 380, 300, 240, 150, 110, 90, 75, 60, 45, 35, 30, 16, 13, 10, 7, 5, 4, 3, 2.5, 2.2, 2,
+};
+constexpr int budget_level_default = 19;
+// blocks compressed at a level before its throughput is trusted
+constexpr std::size_t budget_blocks_min = 4;
+
+// picks the level of every new segment from the throughput measured so far, levels only ever go down
+struct BudgetPlan {
+    using clock = std::chrono::steady_clock;
+
+    std::mutex mutex = {};
+    clock::time_point start = clock::now();
+    double budget = {};
+    std::size_t old_size = {};
+    std::size_t new_size = {};
+    // workers that actually run at the same time
+    unsigned workers = {};
+    // bytes per second of one thread per point of level_speed, from a quick run at level 1
+    double unit = {};
+    // measured over estimated time of the last dict build
+    double dict_scale = 1;
+    int level = {};
+    // measured for the current level by all workers together, seconds are per worker
+    std::size_t level_bytes = {};
+    std::size_t level_blocks = {};
+    double level_seconds = {};
+
+    // binary trees get filled like compressing old file would, hash and chain tables in parallel at about level 1 speed
+    [[nodiscard]] auto dict_seconds(int dict_level) const noexcept -> double {
+        auto const cparams = ZSTD_getCParams(dict_level, this->new_size, this->old_size);
+        auto const speed = cparams.strategy >= ZSTD_btlazy2
+            ? level_speed[dict_level]
+            : level_speed[1] * this->workers;
+        return static_cast<double>(this->old_size) / (this->unit * speed) * this->dict_scale;
+    }
+
+    // highest level up to level_max that gets remaining bytes done in time at rate bytes per second of level_max,
+    // its dict included unless it is the one already built, the one finishing first when none does
+    [[nodiscard]] auto pick(int level_max, double rate, double remaining, double left, int built) const noexcept -> int {
+        auto fastest = level_max;
+        auto fastest_seconds = std::numeric_limits<double>::max();
+        for (auto candidate = level_max; candidate >= 1; --candidate) {
+            auto const candidate_rate = rate * level_speed[candidate] / level_speed[level_max];
+            auto const seconds = (candidate == built ? 0 : this->dict_seconds(candidate)) + remaining / candidate_rate;
+            if (seconds <= left) {
+                return candidate;
+            }
+            if (seconds < fastest_seconds) {
+                fastest = candidate;
+                fastest_seconds = seconds;
+            }
+        }
+        return fastest;
+    }
+
+    auto add_block(int block_level, std::size_t bytes, double seconds, std::size_t in_done) noexcept -> void {
+        auto const lock = std::lock_guard(this->mutex);
+        if (block_level != this->level) {
+            return;
+        }
+        this->level_bytes += bytes;
+        this->level_seconds += seconds;
+        if (++this->level_blocks < budget_blocks_min || this->level == 1) {
+            return;
+        }
+        auto const rate = static_cast<double>(this->level_bytes) / std::max(this->level_seconds, 1e-6) * this->workers;
+        auto const remaining = static_cast<double>(this->new_size - std::min(in_done, this->new_size));
+        auto const left = this->budget - std::chrono::duration<double>(clock::now() - this->start).count();
+        if (remaining / rate <= left) {
+            return;
+        }
+        auto const next = this->pick(this->level, rate, remaining, left, this->level);
+        if (next == this->level) {
+            return;
+        }
+        this->level = next;
+        this->level_bytes = 0;
+        this->level_blocks = 0;
+        this->level_seconds = 0;
+    }
+};
+
+// compress segments of new file as separate frames like zst_diff_segments, but every segment starts with
+// the level the budget plan currently affords, each level gets its own dict once a segment needs it
+static int zst_diff_budget(std::span<char const> old_data,
+                           std::span<char const> new_data,
+                           StreamWriter& writer,
+                           DiffOptions const& options) noexcept {
+    struct Segment {
+        std::size_t in_pos;
+        std::size_t in_size;
+        std::size_t out_size;
+        int level;
+    };
+    using clock = BudgetPlan::clock;
+    if (old_data.size() > dict_size_max) {
+        return exit_other_error("fit old file into a single window");
+    }
+    auto const threads = std::max(options.threads, 1u);
+    auto const level_max = std::clamp(options.level > 0 ? options.level : budget_level_default, 1, ZSTD_maxCLevel());
+
+    // several segments per thread leave room to change levels along the way
+    auto const segment_size = segment_size_for(new_data.size(), threads * 8, std::size_t { 16 } << 20);
+    auto const segment_count = std::max((new_data.size() + segment_size - 1) / segment_size, std::size_t { 1 });
+    auto segments = std::vector<Segment>(segment_count);
+    for (std::size_t i = 0; i != segment_count; ++i) {
+        auto const in_pos = i * segment_size;
+        segments[i] = { in_pos, std::min(segment_size, new_data.size() - in_pos), 0, 0 };
+    }
+
+    auto plan = BudgetPlan {};
+    plan.budget = options.time_budget;
+    plan.old_size = old_data.size();
+    plan.new_size = new_data.size();
+    plan.workers = static_cast<unsigned>(std::min({ std::size_t { threads }, segment_count,
+                                                    std::size_t { std::max(std::thread::hardware_concurrency(), 1u) } }));
+
+    // speed of this machine on this data, every level gets estimated from it until it is measured itself
+    {
+        auto const probe_size = std::min(new_data.size(), budget_blocks_min * ZSTD_BLOCKSIZE_MAX);
+        auto probe = std::vector<char>(ZSTD_compressBound(probe_size));
+        auto const probe_start = clock::now();
+        [[maybe_unused]] auto const unused_ = ZSTD_compress(probe.data(), probe.size(), new_data.data(), probe_size, 1);
+        auto const seconds = std::chrono::duration<double>(clock::now() - probe_start).count();
+        plan.unit = static_cast<double>(std::max(probe_size, std::size_t { 1 })) / std::max(seconds, 1e-6) / level_speed[1];
+    }
+    plan.level = plan.pick(level_max, plan.unit * level_speed[level_max] * plan.workers,
+                           static_cast<double>(new_data.size()),
+                           options.time_budget - std::chrono::duration<double>(clock::now() - plan.start).count(), 0);
+    ::printf("Starting at level %d...\n", plan.level);
+
+    // dicts are built by the first segment that needs them with all threads, others wait for them
+    auto dict_mutex = std::mutex();
+    auto dicts = std::vector<ZSTD_CDict*>(static_cast<std::size_t>(level_max) + 1);
+    auto const free_dicts = [&] () noexcept {
+        for (auto const dict : dicts) {
+            ZSTD_freeCDict(dict);
+        }
+    };
+    auto const dict_for = [&] (int level) noexcept -> ZSTD_CDict const* {
+        auto const lock = std::lock_guard(dict_mutex);
+        auto& dict = dicts[static_cast<std::size_t>(level)];
+        if (dict == nullptr) {
+            auto const dict_start = clock::now();
+            dict = create_dict(old_data, dict_cparams(level, new_data.size(), old_data.size()), threads);
+            auto const seconds = std::chrono::duration<double>(clock::now() - dict_start).count();
+            auto const plan_lock = std::lock_guard(plan.mutex);
+            plan.dict_scale = seconds / std::max(plan.dict_seconds(level) / plan.dict_scale, 1e-6);
+        }
+        return dict;
+    };
+
+    auto const worker_count = std::min(std::size_t { threads }, segment_count);
+    auto contexts = std::vector<ZSTD_CCtx*>(worker_count);
+    auto buffers = std::vector<std::vector<char>>(worker_count);
+    auto ordered = OrderedWriter(writer, segment_count);
+    ::printf("Compress start of %zu segments with %zu threads within %.1fs...\n",
+             segment_count, worker_count, options.time_budget);
+    auto in_done = std::atomic<std::size_t> {};
+    auto const error = run_jobs(worker_count, segment_count, in_done, new_data.size(),
+                                [&] (std::size_t worker, std::size_t index) noexcept {
+        auto& segment = segments[index];
+        auto& ctx = contexts[worker];
+        if (ctx == nullptr) {
+            if ((ctx = ZSTD_createCCtx()) == nullptr) {
+                return zstd_error(ZSTD_error_memory_allocation);
+            }
+            // dict is attached instead of its tables copied for every segment, that would eat the budget
+            if (auto const error = ZSTD_CCtx_setParameter(ctx, ZSTD_c_forceAttachDict, ZSTD_dictForceAttach);
+                    ZSTD_isError(error)) {
+                return error;
+            }
+        }
+        {
+            auto const lock = std::lock_guard(plan.mutex);
+            segment.level = plan.level;
+        }
+        auto const dict = dict_for(segment.level);
+        if (dict == nullptr) {
+            return zstd_error(ZSTD_error_memory_allocation);
+        }
+        auto& buffer = buffers[worker];
+        buffer.resize(ZSTD_compressBound(segment.in_size));
+        auto last_pos = std::size_t{};
+        auto last_time = clock::now();
+        auto const result = compress_frame(ctx, dict,
+                                           new_data.data() + segment.in_pos, segment.in_size,
+                                           buffer.data(), buffer.size(),
+                                           [&] (std::size_t in_pos) noexcept {
+            auto const now = clock::now();
+            in_done += in_pos - last_pos;
+            plan.add_block(segment.level, in_pos - last_pos, std::chrono::duration<double>(now - last_time).count(),
+                           in_done.load());
+            last_pos = in_pos;
+            last_time = now;
+        });
+        segment.out_size = ZSTD_isError(result) ? 0 : result;
+        // frames are independent so they are simply concatenated
+        return ZSTD_isError(result) ? result : ordered.add(index, { buffer.data(), result });
+    });
+    for (auto const ctx : contexts) {
+        ZSTD_freeCCtx(ctx);
+    }
+    free_dicts();
+    ::printf("\n");
+    if (ordered.error) {
+        return exit_mmap_error("write diff file", ordered.error);
+    }
+    if (error) {
+        return exit_zstd_error("compress file", error);
+    }
 
+    // runs of segments that got the same level
+    ::printf("Levels used:\n");
+    for (std::size_t first = 0, last = 0; first != segment_count; first = last) {
+        auto in_size = std::size_t{};
+        auto out_size = std::size_t{};
+        for (last = first; last != segment_count && segments[last].level == segments[first].level; ++last) {
+            in_size += segments[last].in_size;
+            out_size += segments[last].out_size;
+        }
+        ::printf("segments %zu-%zu: level %d, %llu -> %llu\n", first, last - 1, segments[first].level,
+                 static_cast<unsigned long long>(in_size),
+                 static_cast<unsigned long long>(out_size));
+    }
+    ::printf("Took %.2fs of %.2fs budget\n",
+             std::chrono::duration<double>(clock::now() - plan.start).count(), options.time_budget);
     return EXIT_SUCCESS;
 }
 
+// level of the first pass, greedy is the fastest strategy that still finds
+// long matches in a large dict, fast and dfast hash too few positions of it
+constexpr int adaptive_copy_level = 4;
+constexpr int adaptive_level_default = 19;
+// segments old file shrinks to at most this fraction of their size without it are mostly copies of old file
+constexpr std::size_t adaptive_dict_gain = 8;
 
-int main(int argc, char** argv) {
-    if (argc != 4 && argc != 5) {
+// compress every segment of new file at a cheap level with and at level 1 without old file first, segments
+// where old file makes a large difference are copy dominated and done with it, the others are compressed again
+// at the level argument with only the old region they match as dict, so the expensive dict tables only ever
+// cover a few segments worth of old file
+static int zst_diff_adaptive(std::span<char const> old_data,
+                             std::span<char const> new_data,
+                             StreamWriter& writer,
+                             DiffOptions const& options) noexcept {
+    struct Segment {
+        SegmentWindow window;
+        int level;
+    };
+    // output of both levels, the smaller one goes to the diff file
+    struct Buffers {
+        std::vector<char> copy;
+        std::vector<char> novel;
+    };
+    auto const threads = std::max(options.threads, 1u);
+    auto const novel_level = std::clamp(options.level > 0 ? options.level : adaptive_level_default,
+                                        1, ZSTD_maxCLevel());
+    // small segments follow the regions closely, the window keeps a bit of context around them
+    auto const segment_size = segment_size_for(new_data.size(), threads * 8, std::size_t { 4 } << 20);
+
+    ::printf("Chunking old and new file...\n");
+    auto const windows = plan_windows(chunk_data(new_data, threads), ChunkIndex(chunk_data(old_data, threads)),
+                                      new_data.size(), old_data.size(),
+                                      segment_size, segment_size * 2);
+
+    auto segments = std::vector<Segment>();
+    for (auto const& window : windows) {
+        segments.push_back({ window, adaptive_copy_level });
+    }
+
+    // old file too large for one window gets the region windows at the cheap level too
+    auto copy_dict = static_cast<ZSTD_CDict*>(nullptr);
+    if (old_data.size() <= dict_size_max) {
+        ::printf("Loading dictionary...\n");
+        copy_dict = create_dict(old_data, window_cparams(adaptive_copy_level, { 0, segment_size, 0, old_data.size() }),
+                                threads);
+        if (copy_dict == nullptr) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // spare threads help indexing when there are fewer segments than threads
+    auto const worker_count = std::min(std::size_t { threads }, segments.size());
+    auto const dict_threads = static_cast<unsigned>(threads / worker_count);
+    auto contexts = std::vector<WindowContext>(worker_count);
+    auto buffers = std::vector<Buffers>(worker_count);
+    auto ordered = OrderedWriter(writer, segments.size());
+
+    ::printf("Compress start of %zu segments with %zu threads...\n", segments.size(), worker_count);
+    auto in_done = std::atomic<std::size_t> {};
+    auto const error = run_jobs(worker_count, segments.size(), in_done, new_data.size(),
+                                [&] (std::size_t worker, std::size_t index) noexcept {
+        auto& segment = segments[index];
+        auto& context = contexts[worker];
+        auto const& window = segment.window;
+        auto const bound = ZSTD_compressBound(window.new_size);
+        if (context.ctx == nullptr && (context.ctx = ZSTD_createCCtx()) == nullptr) {
+            return zstd_error(ZSTD_error_memory_allocation);
+        }
+        // record only when the frame does not get whole old file as dict, the zstpatch default
+        auto const compress = [&] (int level, char* out) noexcept -> std::size_t {
+            auto record_size = std::size_t{};
+            auto dict = static_cast<ZSTD_CDict const*>(copy_dict);
+            if (level != adaptive_copy_level || copy_dict == nullptr) {
+                if (auto const error = context.prepare(old_data, window, level, dict_threads); ZSTD_isError(error)) {
+                    return error;
+                }
+                record_size = write_dict_window(out, { window.old_pos, window.old_size });
+                dict = context.dict;
+            }
+            auto const result = compress_frame(context.ctx, dict,
+                                               new_data.data() + window.new_pos, window.new_size,
+                                               out + record_size, bound,
+                                               [] (std::size_t) noexcept {});
+            return ZSTD_isError(result) ? result : record_size + result;
+        };
+        auto& buffer = buffers[worker];
+        buffer.copy.resize(dict_window_record_size + bound);
+        buffer.novel.resize(dict_window_record_size + bound);
+        auto const plain_size = ZSTD_compressCCtx(context.ctx, buffer.novel.data(), bound,
+                                                  new_data.data() + window.new_pos, window.new_size, 1);
+        if (ZSTD_isError(plain_size)) {
+            return plain_size;
+        }
+        auto const copy_size = compress(adaptive_copy_level, buffer.copy.data());
+        if (ZSTD_isError(copy_size)) {
+            return copy_size;
+        }
+        auto out = std::span<char const> { buffer.copy.data(), copy_size };
+        if (copy_size * adaptive_dict_gain > plain_size && novel_level > adaptive_copy_level) {
+            // a higher level with a narrower dict can still lose against whole old file, smaller one wins
+            auto const novel_size = compress(novel_level, buffer.novel.data());
+            if (ZSTD_isError(novel_size)) {
+                return novel_size;
+            }
+            if (novel_size < copy_size) {
+                segment.level = novel_level;
+                out = { buffer.novel.data(), novel_size };
+            }
+        }
+        in_done += window.new_size;
+        // records and frames are independent so they are simply concatenated
+        return ordered.add(index, out);
+    });
+    contexts.clear();
+    ZSTD_freeCDict(copy_dict);
+    ::printf("\n");
+    if (ordered.error) {
+        return exit_mmap_error("write diff file", ordered.error);
+    }
+    if (error) {
+        return exit_zstd_error("compress file", error);
+    }
+
+    auto novel_count = std::size_t{};
+    for (auto const& segment : segments) {
+        novel_count += segment.level != adaptive_copy_level;
+    }
+    ::printf("Adaptive: %zu of %zu segments copy dominated at level %d, %zu novel at level %d\n",
+             segments.size() - novel_count, segments.size(), adaptive_copy_level, novel_count, novel_level);
+    return EXIT_SUCCESS;
+}
+
+// part of a stream held in memory per thread, output takes about as much again
+constexpr std::size_t stream_segment_size = std::size_t { 32 } << 20;
+// segments of a window still get a few blocks each
+constexpr std::size_t map_segment_size_min = std::size_t { 1 } << 20;
+
+// new file comes from a stream of unknown size, so it is read a segment per thread at a time and every
+// segment becomes a frame of known content size with whole old file as dict, like zst_diff_segments
+// memory stays bounded by the segments in flight however long the stream gets,
+// a windowed reader hands out a round in place as one window that gets split between threads instead
+static int zst_diff_stream(std::span<char const> old_data,
+                           StreamReader& reader,
+                           StreamWriter& writer,
+                           DiffOptions const& options) noexcept {
+    struct Segment {
+        std::vector<char> in;
+        std::span<char const> data;
+        std::vector<char> out;
+        std::size_t out_size;
+    };
+    if (old_data.size() > dict_size_max) {
+        return exit_other_error("fit old file into a single window");
+    }
+    auto const threads = std::max(options.threads, 1u);
+    auto const window_size = reader.window_size();
+    auto const segment_size = reader.is_windowed()
+        ? std::max((window_size + threads - 1) / threads, std::min(map_segment_size_min, window_size))
+        : stream_segment_size;
+    auto const cparams = window_cparams(options.level, { 0, segment_size, 0, old_data.size() });
+    auto map_index = MMap<char const>();
+    auto const dict = prepare_dict(map_index, old_data, cparams, options);
+    if (dict == nullptr) {
+        return EXIT_FAILURE;
+    }
+    auto pool = ContextPool();
+    if (auto const result = pool.create(threads, dict, cparams.windowLog)) {
+        ZSTD_freeCDict(dict);
+        return result;
+    }
+
+    ::printf("Compress start with %u threads...\n", threads);
+    auto segments = std::vector<Segment>(threads);
+    auto in_total = std::size_t{};
+    auto at_end = false;
+    while (!at_end) {
+        // one segment per thread, a short read is the end of the stream
+        auto const done_before = in_total;
+        auto segment_count = std::size_t{};
+        if (reader.is_windowed()) {
+            auto round = std::span<char const> {};
+            if (auto error = reader.view(round)) {
+                ZSTD_freeCDict(dict);
+                return exit_mmap_error("read new file window", error);
+            }
+            at_end = round.size() != window_size;
+            // empty file still gets its empty frame
+            segment_count = std::max((round.size() + segment_size - 1) / segment_size, std::size_t { in_total == 0 });
+            for (std::size_t i = 0; i != segment_count; ++i) {
+                segments[i].data = round.subspan(i * segment_size, std::min(segment_size, round.size() - i * segment_size));
+            }
+            in_total += round.size();
+        }
+        while (!reader.is_windowed() && segment_count != segments.size() && !at_end) {
+            auto& segment = segments[segment_count];
+            segment.in.resize(segment_size);
+            auto in_size = std::size_t {};
+            if (auto error = reader.read(segment.in, in_size)) {
+                ZSTD_freeCDict(dict);
+                return exit_mmap_error("read new file", error);
+            }
+            segment.data = { segment.in.data(), in_size };
+            at_end = segment.data.size() != segment_size;
+            // empty stream still gets its empty frame, a stream ending with a full segment does not
+            if (segment.data.empty() && in_total != 0) {
+                break;
+            }
+            in_total += segment.data.size();
+            ++segment_count;
+        }
+
+        auto in_done = std::atomic<std::size_t> { done_before };
+        auto const error = run_jobs(std::min(pool.contexts.size(), segment_count), segment_count, in_done, in_total,
+                                    [&] (std::size_t worker, std::size_t index) noexcept {
+            auto& segment = segments[index];
+            segment.out.resize(ZSTD_compressBound(segment.data.size()));
+            auto last_pos = std::size_t{};
+            auto const result = compress_frame(pool.contexts[worker], dict,
+                                               segment.data.data(), segment.data.size(),
+                                               segment.out.data(), segment.out.size(),
+                                               [&] (std::size_t in_pos) noexcept {
+                in_done += in_pos - last_pos;
+                last_pos = in_pos;
+            });
+            segment.out_size = ZSTD_isError(result) ? 0 : result;
+            return result;
+        });
+        if (error) {
+            ZSTD_freeCDict(dict);
+            ::printf("\n");
+            return exit_zstd_error("compress file", error);
+        }
+
+        // frames are independent so they are simply appended
+        for (std::size_t i = 0; i != segment_count; ++i) {
+            if (auto error = writer.write({ segments[i].out.data(), segments[i].out_size })) {
+                ZSTD_freeCDict(dict);
+                ::printf("\n");
+                return exit_mmap_error("write diff file", error);
+            }
+        }
+    }
+    ZSTD_freeCDict(dict);
+    ::printf("\n");
+    return EXIT_SUCCESS;
+}
+
+// samples of new file spread evenly over it, compressing the whole file scales from theirs
+constexpr std::size_t give_up_sample_size = std::size_t { 512 } << 10;
+constexpr std::size_t give_up_sample_count = 4;
+// dict this cheap loads in a fraction of the time of a high level one, enough to tell unrelated files apart
+constexpr int give_up_probe_level = 4;
+// first check after this part of new file, every following one after as much as is done already
+constexpr std::size_t give_up_first_part = 32;
+// no more checks once this part of new file paid off, the rest goes in one go
+constexpr std::size_t give_up_last_part = 4;
+
+// compressed size of the samples against dict, or without one when it is nullptr, scaled up to all of new file
+// returns estimated size or zstd error
+static std::size_t sample_estimate(ZSTD_CCtx* ctx, std::span<char const> new_data,
+                                   ZSTD_CDict const* dict, int level) noexcept {
+    auto const sample_count = new_data.size() > give_up_sample_size * give_up_sample_count
+        ? give_up_sample_count
+        : std::size_t { 1 };
+    auto const sample_size = sample_count == 1 ? new_data.size() : give_up_sample_size;
+    if (sample_size == 0) {
+        return 0;
+    }
+    auto buffer = std::vector<char>(ZSTD_compressBound(sample_size));
+    auto out_size = std::uint64_t {};
+    for (std::size_t i = 0; i != sample_count; ++i) {
+        // last sample ends with new file
+        auto const pos = i * (new_data.size() - sample_size) / std::max(sample_count - 1, std::size_t { 1 });
+        auto const result = dict == nullptr
+            ? ZSTD_compressCCtx(ctx, buffer.data(), buffer.size(), new_data.data() + pos, sample_size, level)
+            : compress_frame(ctx, dict, new_data.data() + pos, sample_size, buffer.data(), buffer.size(),
+                             [] (std::size_t) noexcept {});
+        if (ZSTD_isError(result)) {
+            return result;
+        }
+        out_size += result;
+    }
+    return static_cast<std::size_t>(out_size * new_data.size() / (sample_count * sample_size));
+}
+
+// diff pays off while it stays below plain compression of the same part of new file,
+// copied_size is new file records already took care of, plain compression would have had to pay for it too
+static bool pays_off(std::uint64_t diff_size, std::size_t plain_size, std::size_t part_size,
+                     std::size_t copied_size, std::size_t new_size) noexcept {
+    auto const plain_part = static_cast<double>(plain_size) * static_cast<double>(part_size + copied_size)
+        / static_cast<double>(std::max(new_size, std::size_t { 1 }));
+    ::printf("Diff of %llu bytes is %llu bytes, plain about %.0f...\n",
+             static_cast<unsigned long long>(part_size + copied_size), static_cast<unsigned long long>(diff_size),
+             plain_part);
+    if (static_cast<double>(diff_size) < plain_part) {
+        return true;
+    }
+    ::printf("Diff does not pay off, giving up...\n");
+    return false;
+}
+
+// samples of new file against a cheap dict over old file and without one, an unrelated old file
+// gives up here before the real dict gets loaded, returns exit_no_payoff then
+static int probe_payoff(std::span<char const> old_data,
+                        std::span<char const> new_data,
+                        std::size_t copied_size,
+                        DiffOptions const& options) noexcept {
+    ::printf("Probing with level %d dictionary...\n", give_up_probe_level);
+    auto const ctx = ZSTD_createCCtx();
+    if (ctx == nullptr) {
+        return exit_other_error("allocate compress context");
+    }
+    auto const dict = create_dict(old_data,
+                                  dict_cparams(give_up_probe_level, give_up_sample_size, old_data.size()),
+                                  options.threads);
+    if (dict == nullptr) {
+        ZSTD_freeCCtx(ctx);
+        return EXIT_FAILURE;
+    }
+    auto const plain_size = sample_estimate(ctx, new_data, nullptr, give_up_probe_level);
+    auto const diff_size = ZSTD_isError(plain_size)
+        ? plain_size
+        : sample_estimate(ctx, new_data, dict, give_up_probe_level);
+    ZSTD_freeCDict(dict);
+    ZSTD_freeCCtx(ctx);
+    if (ZSTD_isError(diff_size)) {
+        return exit_zstd_error("compress samples", diff_size);
+    }
+    return pays_off(diff_size, plain_size, new_data.size(), copied_size, new_data.size())
+        ? EXIT_SUCCESS
+        : exit_no_payoff;
+}
+
+// new file goes in rounds of segments, every round doubles what is done, and after each the diff so far
+// has to be smaller than plain compression of the same part would be, a renamed or regenerated file fails
+// that after the first few percent instead of at the end, exit_no_payoff then tells the caller
+static int zst_diff_paying(std::span<char const> new_data,
+                           std::size_t copied_size,
+                           ZSTD_CDict const* dict,
+                           unsigned window_log,
+                           StreamWriter& writer,
+                           DiffOptions const& options) noexcept {
+    ::printf("Estimating plain compression...\n");
+    auto const ctx = ZSTD_createCCtx();
+    if (ctx == nullptr) {
+        return exit_other_error("allocate compress context");
+    }
+    auto const plain_size = sample_estimate(ctx, new_data, nullptr, options.level);
+    ZSTD_freeCCtx(ctx);
+    if (ZSTD_isError(plain_size)) {
+        return exit_zstd_error("compress samples", plain_size);
+    }
+    auto const threads = std::max(options.threads, 1u);
+    // records in front of the frames are not part of what competes with plain compression
+    auto const frames_start = writer.size();
+    auto in_pos = std::size_t {};
+    auto round_size = std::max(new_data.size() / give_up_first_part, std::size_t { ZSTD_BLOCKSIZE_MAX } * threads);
+    while (in_pos != new_data.size()) {
+        auto const in_size = in_pos >= new_data.size() / give_up_last_part
+            ? new_data.size() - in_pos
+            : std::min(round_size, new_data.size() - in_pos);
+        if (auto const result = zst_diff_segments(new_data.subspan(in_pos, in_size), dict, window_log,
+                                                  writer, threads)) {
+            return result;
+        }
+        in_pos += in_size;
+        round_size = in_pos;
+        if (in_pos != new_data.size()
+            && !pays_off(writer.size() - frames_start, plain_size, in_pos, copied_size, new_data.size())) {
+            return exit_no_payoff;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// copied_size is how much of new file records already took care of
+static int zst_diff_data(std::span<char const> old_data,
+                         std::span<char const> new_data,
+                         std::size_t copied_size,
+                         StreamWriter& writer,
+                         DiffOptions const& options) noexcept {
+    if (options.long_distance) {
+        return zst_diff_long(old_data, new_data, writer, options.level, options.threads);
+    }
+    if (options.windowed) {
+        return zst_diff_windowed(old_data, new_data, writer, options);
+    }
+    if (options.byte_diff) {
+        return zst_diff_byte_diff(old_data, new_data, writer, options);
+    }
+    if (options.adaptive) {
+        return zst_diff_adaptive(old_data, new_data, writer, options);
+    }
+    if (options.time_budget > 0) {
+        return zst_diff_budget(old_data, new_data, writer, options);
+    }
+    if (old_data.size() > dict_size_max && !options.single_frame) {
+        // segment windows write frames their own way, same as an explicit --windowed
+        if (options.give_up) {
+            return exit_other_error("check payoff, segment windows of an old file this large skip it");
+        }
+        ::printf("Old file exceeds largest window, using segment windows...\n");
+        return zst_diff_windowed(old_data, new_data, writer, options);
+    }
+
+    auto copies = std::vector<ChunkCopy>();
+    if (options.copy_chunks) {
+        auto const threads = std::max(options.threads, 1u);
+        ::printf("Chunking old and new file...\n");
+        copies = find_copies(old_data, new_data,
+                             chunk_data(new_data, threads),
+                             ChunkIndex(chunk_data(old_data, threads)));
+    }
+
+    // suffix array replaces the dict entirely
+    if (options.suffix_array) {
+        if (old_data.size() + new_data.size() > sequence_offset_max) {
+            return exit_other_error("fit old and new file into a single frame");
+        }
+        auto const threads = std::max(options.threads, 1u);
+        ::printf("Sorting old file suffixes with %u threads...\n", threads);
+        auto const suffixes = SuffixArray::build(old_data, threads);
+        return zst_diff_single_frame(old_data, new_data, nullptr, 0, copies, &suffixes, writer, threads);
+    }
+
+    // a high level dict takes long to load, a cheap one tells whether that is worth it at all
+    if (options.give_up && options.level > give_up_probe_level) {
+        if (auto const result = probe_payoff(old_data, new_data, copied_size, options)) {
+            return result;
+        }
+    }
+
+    auto const cparams = dict_cparams(options.level, new_data.size(), old_data.size());
+    auto map_index = MMap<char const>();
+    auto const dict = prepare_dict(map_index, old_data, cparams, options);
+    if (dict == nullptr) {
+        return EXIT_FAILURE;
+    }
+
+    if (options.give_up) {
+        auto const result = zst_diff_paying(new_data, copied_size, dict, cparams.windowLog, writer, options);
+        ZSTD_freeCDict(dict);
+        return result;
+    }
+
+    if (options.threads > 1 || options.single_frame) {
+        auto const threads = std::max(options.threads, 1u);
+        auto const result = options.single_frame
+            ? zst_diff_single_frame(old_data, new_data, dict, cparams.windowLog, copies, nullptr, writer, threads)
+            : zst_diff_segments(new_data, dict, cparams.windowLog, writer, threads);
+        ZSTD_freeCDict(dict);
+        return result;
+    }
+
+    // create context and set correct params for buffer-less compression(no internal copies)
+    auto const ctx = ZSTD_createCCtx();
+    if (ctx == nullptr) {
+        return exit_other_error("allocate compress context");
+    }
+    if (auto const error = ZSTD_CCtx_refCDict(ctx, dict); ZSTD_isError(error)) {
+        return exit_zstd_error("set refCDict", error);
+    }
+
+    // do compression, every block goes out as soon as it is compressed
+    ::printf("Compress start...\n");
+    auto write_error = MMapError {};
+    auto const out_size = write_frame(ctx, dict,
+                                      new_data.data(), new_data.size(),
+                                      writer, write_error,
+                                      [&] (std::size_t in_pos) noexcept {
+        print_progress(in_pos, new_data.size());
+    });
+    ::printf("\n");
+
+    // free context and dict structs
+    ZSTD_freeCCtx(ctx);
+    ZSTD_freeCDict(dict);
+
+    if (write_error) {
+        return exit_mmap_error("write diff file", write_error);
+    }
+    if (ZSTD_isError(out_size)) {
+        return exit_zstd_error("compress file", out_size);
+    }
+    return EXIT_SUCCESS;
+}
+
+// shared start and end below this are left to the match search, a record is not worth it
+constexpr std::size_t affix_size_min = std::size_t { 4 } << 10;
+
+// start and end that new file shares with old file are never searched, a record tells zstpatch to copy them
+// and frames only hold the middle, identical files end up with nothing but that record
+static int zst_diff_trimmed(std::span<char const> old_data,
+                            std::span<char const> new_data,
+                            StreamWriter& writer,
+                            DiffOptions const& options) noexcept {
+    if (!options.trim) {
+        return zst_diff_data(old_data, new_data, 0, writer, options);
+    }
+    auto const prefix_size = common_prefix_size(old_data, new_data);
+    // suffix can overlap the prefix in old file, only new file has to be split between them
+    auto const suffix_size = common_suffix_size(old_data, new_data.subspan(prefix_size));
+    if (prefix_size + suffix_size < affix_size_min && prefix_size + suffix_size != new_data.size()) {
+        return zst_diff_data(old_data, new_data, 0, writer, options);
+    }
+    ::printf("Copying %llu bytes of shared start and %llu bytes of shared end...\n",
+             static_cast<unsigned long long>(prefix_size),
+             static_cast<unsigned long long>(suffix_size));
+    char record[common_affix_record_size];
+    if (auto error = writer.write({ record, write_common_affix(record, { prefix_size, suffix_size }) })) {
+        return exit_mmap_error("write diff file", error);
+    }
+    auto const middle = new_data.subspan(prefix_size, new_data.size() - prefix_size - suffix_size);
+    if (middle.empty()) {
+        return EXIT_SUCCESS;
+    }
+    return zst_diff_data(old_data, middle, prefix_size + suffix_size, writer, options);
+}
+
+// filter works on copies, zstpatch filters old file the same way and unfilters its output
+// its record goes in front of everything else so zstpatch knows before it reads anything
+static int zst_diff_filtered(std::span<char const> old_data,
+                             std::span<char const> new_data,
+                             StreamWriter& writer,
+                             DiffOptions const& options) noexcept {
+    auto const old_code = find_code_sections(old_data);
+    auto const new_code = find_code_sections(new_data);
+    if (old_code.sections.empty() && new_code.sections.empty()) {
+        ::printf("No code sections found, diffing unfiltered...\n");
+        return zst_diff_trimmed(old_data, new_data, writer, options);
+    }
+    ::printf("Filtering branches in %zu old and %zu new code sections...\n",
+             old_code.sections.size(), new_code.sections.size());
+    auto filtered_old = std::vector<char>(old_data.begin(), old_data.end());
+    auto filtered_new = std::vector<char>(new_data.begin(), new_data.end());
+    filter_branches(filtered_old, old_code);
+    filter_branches(filtered_new, new_code);
+    char record[branch_filter_record_size];
+    if (auto error = writer.write({ record, write_branch_filter(record) })) {
+        return exit_mmap_error("write diff file", error);
+    }
+    return zst_diff_trimmed(filtered_old, filtered_new, writer, options);
+}
+
+// standard frame without dict in place of everything written so far, plain zstd decompresses it and so does zstpatch
+// output already gone down a pipe cannot be replaced, the caller only gets exit_no_payoff then
+static int zst_diff_plain(std::span<char const> new_data,
+                          StreamWriter& writer,
+                          DiffOptions const& options) noexcept {
+    if (auto error = writer.truncate(0)) {
+        ::fprintf(stderr, "Diff does not pay off and diff file cannot be rewritten\n");
+        return exit_no_payoff;
+    }
+    auto const ctx = ZSTD_createCCtx();
+    if (ctx == nullptr) {
+        return exit_other_error("allocate compress context");
+    }
+    if (auto const error = set_parameters(ctx, {
+            { ZSTD_c_compressionLevel, options.level },
+            { ZSTD_c_checksumFlag, 1 },
+            { ZSTD_c_nbWorkers, options.threads > 1 ? clamp_workers(ZSTD_c_nbWorkers, options.threads) : 0 },
+        }); ZSTD_isError(error)) {
+        ZSTD_freeCCtx(ctx);
+        return exit_zstd_error("set plain parameters", error);
+    }
+    if (auto const error = ZSTD_CCtx_setPledgedSrcSize(ctx, new_data.size()); ZSTD_isError(error)) {
+        ZSTD_freeCCtx(ctx);
+        return exit_zstd_error("set pledged size", error);
+    }
+
+    ::printf("Compress start without dict...\n");
+    auto in = ZSTD_inBuffer { new_data.data(), new_data.size(), 0 };
+    for (;;) {
+        auto const dst = writer.reserve(ZSTD_CStreamOutSize());
+        auto out = ZSTD_outBuffer { dst.data(), dst.size(), 0 };
+        auto const remaining = ZSTD_compressStream2(ctx, &out, &in, ZSTD_e_end);
+        if (ZSTD_isError(remaining)) {
+            ZSTD_freeCCtx(ctx);
+            ::printf("\n");
+            return exit_zstd_error("compress file", remaining);
+        }
+        if (auto error = writer.commit(out.pos)) {
+            ZSTD_freeCCtx(ctx);
+            ::printf("\n");
+            return exit_mmap_error("write diff file", error);
+        }
+        print_progress(in.pos, new_data.size());
+        if (remaining == 0) {
+            break;
+        }
+    }
+    ZSTD_freeCCtx(ctx);
+    ::printf("\n");
+    return EXIT_SUCCESS;
+}
+
+static int zst_diff(std::filesystem::path const& path_old,
+                    std::filesystem::path const& path_new,
+                    std::filesystem::path const& path_diff,
+                    DiffOptions const& options) noexcept {
+    // diff goes out as it is produced, nothing gets sized for the worst case up front
+    // stdout is taken first as that moves everything printed over to stderr, a file is only created
+    // once both inputs are open so one that fails to open leaves an existing diff file alone
+    auto writer = StreamWriter();
+    auto const to_stdout = path_diff == "-";
+    auto const create_writer = [&] () noexcept {
+        if (auto error = writer.create(path_diff)) {
+            return exit_mmap_error("create diff file", error);
+        }
+        return EXIT_SUCCESS;
+    };
+    if (to_stdout) {
+        if (auto const result = create_writer()) {
+            return result;
+        }
+    }
+
+    auto map_old = MMap<char const>();
+    ::printf("Maping old file...\n");
+    if (auto error = map_old.open(path_old, options.old_map)) {
+        return exit_mmap_error("open old file", error);
+    }
+
+    // pipes have no size to map, with a map window new file is only ever mapped in part
+    auto result = EXIT_SUCCESS;
+    if (path_new == "-" || options.map_window != 0) {
+        auto reader = StreamReader();
+        ::printf("Opening new file stream...\n");
+        if (auto error = options.map_window != 0
+                ? reader.open(path_new, options.map_window, options.new_read)
+                : reader.open(path_new)) {
+            return exit_mmap_error("open new file", error);
+        }
+        if (!to_stdout) {
+            if (auto const create_result = create_writer()) {
+                return create_result;
+            }
+        }
+        result = zst_diff_stream(map_old.span(), reader, writer, options);
+    } else {
+        auto map_new = MMap<char const>();
+        ::printf("Maping new file...\n");
+        if (auto error = map_new.open(path_new)) {
+            return exit_mmap_error("open new file", error);
+        }
+        if (!to_stdout) {
+            if (auto const create_result = create_writer()) {
+                return create_result;
+            }
+        }
+        // compressed front to back, segments each from their own start
+        advise_access(map_new.span(), MMapAccess::sequential);
+        result = options.branch_filter
+            ? zst_diff_filtered(map_old.span(), map_new.span(), writer, options)
+            : zst_diff_trimmed(map_old.span(), map_new.span(), writer, options);
+        if (result == exit_no_payoff) {
+            result = zst_diff_plain(map_new.span(), writer, options);
+        }
+    }
+    if (result != EXIT_SUCCESS) {
+        // no partial diff is left behind, it would only fail later in zstpatch
+        if (!to_stdout) {
+            [[maybe_unused]] auto const unused_ = writer.truncate(0);
+        }
+        [[maybe_unused]] auto const unused_ = writer.close();
+        return result;
+    }
+
+    ::printf("Flush diff file...\n");
+    if (auto error = writer.close()) {
+        return exit_mmap_error("close diff file", error);
+    }
+    ::printf("Done!\n");
+    return EXIT_SUCCESS;
+}
+
+// windows of new file looked up in the fingerprint index, the rest of new file is assumed to look like them
+constexpr std::size_t estimate_window_size = std::size_t { 4 } << 10;
+constexpr std::size_t estimate_window_count = 256;
+// levels the estimate is printed for, bytes of the windows not found in old file get compressed at every one
+constexpr int estimate_levels[] = { 1, 3, 5, 7, 9, 12, 15, 17, 19, 22 };
+// bytes a match takes in a frame, offset and lengths after entropy coding
+constexpr double estimate_match_cost = 3;
+// time a byte found in old file takes relative to one that is not, long matches skip most of the search
+constexpr double estimate_covered_cost = 0.25;
+// bytes not found in old file that are enough to time a level on them instead of going by level_speed
+constexpr std::size_t estimate_timed_min = std::size_t { 64 } << 10;
+// start of old file a dict gets built over at every level, its time scales up to all of old file
+constexpr std::size_t estimate_dict_probe_size = std::size_t { 1 } << 20;
+// pieces of new file spread like the windows, compressed at every level against the old regions they match
+constexpr std::size_t estimate_calibrate_count = 64;
+// old region around where a piece matches, room for what got inserted into or deleted from it
+constexpr std::size_t estimate_calibrate_region = 4 * estimate_window_size;
+
+// predicts size and time of a default diff at several levels from a small part of the work, matches come from
+// fingerprints instead of a dict, how many of them a level actually finds is calibrated on pieces of new file
+// against a dict over the old regions they match, with tables shrunk along with the regions so they fill up as
+// they would over all of old file, time is measured on the bytes not found and a dict over a part of old file
+static int zst_estimate(std::filesystem::path const& path_old,
+                        std::filesystem::path const& path_new,
+                        DiffOptions const& options) noexcept {
+    using clock = std::chrono::steady_clock;
+    auto const start = clock::now();
+    auto map_old = MMap<char const>();
+    ::printf("Maping old file...\n");
+    if (auto error = map_old.open(path_old, options.old_map)) {
+        return exit_mmap_error("open old file", error);
+    }
+    auto map_new = MMap<char const>();
+    ::printf("Maping new file...\n");
+    if (auto error = map_new.open(path_new)) {
+        return exit_mmap_error("open new file", error);
+    }
+    // only windows spread over new file get read
+    advise_access(map_new.span(), MMapAccess::random);
+    auto const old_data = map_old.span();
+    auto const new_data = map_new.span();
+    auto const threads = std::max(options.threads, 1u);
+
+    // shared start and end cost nothing but their record
+    auto const prefix_size = options.trim ? common_prefix_size(old_data, new_data) : std::size_t {};
+    auto const suffix_size = options.trim
+        ? common_suffix_size(old_data, new_data.subspan(prefix_size))
+        : std::size_t {};
+    auto const middle = new_data.subspan(prefix_size, new_data.size() - prefix_size - suffix_size);
+
+    ::printf("Indexing old file fingerprints with %u threads...\n", threads);
+    auto const index = FingerprintIndex::build(old_data, threads);
+    auto const window_count = middle.size() > estimate_window_size * estimate_window_count
+        ? estimate_window_count
+        : std::size_t { 1 };
+    auto const window_size = window_count == 1 ? middle.size() : estimate_window_size;
+    auto sample = std::vector<char>();
+    auto novel = std::vector<char>();
+    auto cover = WindowCover {};
+    for (std::size_t i = 0; i != window_count; ++i) {
+        // last window ends with new file
+        auto const pos = i * (middle.size() - window_size) / std::max(window_count - 1, std::size_t { 1 });
+        auto const window = middle.subspan(pos, window_size);
+        sample.insert(sample.end(), window.begin(), window.end());
+        auto const window_cover = index.cover(window, novel);
+        cover.covered_size += window_cover.covered_size;
+        cover.match_count += window_cover.match_count;
+    }
+    auto const scale = static_cast<double>(middle.size())
+        / static_cast<double>(std::max(window_count * window_size, std::size_t { 1 }));
+
+    // fast levels with small tables reach only a part of old file, cover alone counts every match as found
+    auto calibrate = std::vector<char>();
+    auto calibrate_old = std::vector<char>();
+    auto calibrate_novel = std::vector<char>();
+    auto calibrate_cover = WindowCover {};
+    auto const piece_size = std::min(middle.size(), estimate_window_size);
+    auto const piece_count = std::min(estimate_calibrate_count,
+                                      (middle.size() + piece_size - 1) / std::max(piece_size, std::size_t { 1 }));
+    auto const region_size = std::min(old_data.size(), estimate_calibrate_region);
+    for (std::size_t i = 0; i != piece_count; ++i) {
+        auto const pos = i * (middle.size() - piece_size) / std::max(piece_count - 1, std::size_t { 1 });
+        auto const piece = middle.subspan(pos, piece_size);
+        calibrate.insert(calibrate.end(), piece.begin(), piece.end());
+        auto const piece_cover = index.cover(piece, calibrate_novel);
+        calibrate_cover.covered_size += piece_cover.covered_size;
+        calibrate_cover.match_count += piece_cover.match_count;
+        if (piece_cover.old_begin >= piece_cover.old_end) {
+            continue;
+        }
+        // fixed size around the middle of the matches, one of content repeated far away only shifts it
+        auto const center = piece_cover.old_begin + (piece_cover.old_end - piece_cover.old_begin) / 2;
+        auto const begin = std::min(center - std::min(center, std::uint64_t { region_size / 2 }),
+                                    std::uint64_t { old_data.size() - region_size });
+        auto const region = old_data.subspan(begin, region_size);
+        calibrate_old.insert(calibrate_old.end(), region.begin(), region.end());
+    }
+    // every halving of old file halves the tables too
+    auto const calibrate_shift = calibrate_old.empty() || calibrate_old.size() >= old_data.size()
+        ? 0u
+        : static_cast<unsigned>(std::bit_width(old_data.size() / calibrate_old.size()) - 1);
+
+    // level 1 speed of this machine on this data, levels not timed on novel bytes go by level_speed from it
+    // windows are in memory already, pages of new file faulted in would be timed too
+    auto const workers = std::min(threads, std::max(std::thread::hardware_concurrency(), 1u));
+    auto const probe_data = sample.size() >= estimate_timed_min
+        ? std::span<char const> { sample }
+        : old_data.first(std::min(old_data.size(), estimate_window_size * estimate_window_count));
+    auto unit = double {};
+    {
+        auto probe = std::vector<char>(ZSTD_compressBound(probe_data.size()));
+        auto const probe_start = clock::now();
+        [[maybe_unused]] auto const unused_ = ZSTD_compress(probe.data(), probe.size(),
+                                                            probe_data.data(), probe_data.size(), 1);
+        auto const seconds = std::chrono::duration<double>(clock::now() - probe_start).count();
+        unit = static_cast<double>(std::max(probe_data.size(), std::size_t { 1 })) / std::max(seconds, 1e-6)
+            / level_speed[1];
+    }
+
+    auto const covered_size = static_cast<double>(cover.covered_size) * scale;
+    auto const novel_size = static_cast<double>(middle.size()) - covered_size;
+    ::printf("Shared start and end: %llu bytes, found in old file: %.0f of %llu bytes with about %.0f matches\n",
+             static_cast<unsigned long long>(prefix_size + suffix_size), covered_size,
+             static_cast<unsigned long long>(middle.size()), static_cast<double>(cover.match_count) * scale);
+    ::printf("Level  Diff size  Seconds\n");
+    auto const ctx = ZSTD_createCCtx();
+    if (ctx == nullptr) {
+        return exit_other_error("allocate compress context");
+    }
+    // dict gets timed over the start of old file with the tables it would have over all of it
+    auto const dict_probe = old_data.first(std::min(old_data.size(), estimate_dict_probe_size));
+    auto buffer = std::vector<char>(ZSTD_compressBound(novel.size()));
+    auto calibrate_buffer = std::vector<char>(ZSTD_compressBound(calibrate.size()));
+    for (auto const level : estimate_levels) {
+        auto const level_start = clock::now();
+        auto const out_size = novel.empty()
+            ? std::size_t {}
+            : ZSTD_compressCCtx(ctx, buffer.data(), buffer.size(), novel.data(), novel.size(), level);
+        if (ZSTD_isError(out_size)) {
+            ZSTD_freeCCtx(ctx);
+            return exit_zstd_error("compress novel bytes", out_size);
+        }
+        auto const level_seconds = std::chrono::duration<double>(clock::now() - level_start).count();
+        auto const rate = novel.size() >= estimate_timed_min
+            ? static_cast<double>(novel.size()) / std::max(level_seconds, 1e-6)
+            : unit * level_speed[level];
+
+        auto dict_seconds = double {};
+        if (!middle.empty() && !dict_probe.empty()) {
+            auto const dict_start = clock::now();
+            auto const dict = create_dict(dict_probe, dict_cparams(level, middle.size(), old_data.size()), threads);
+            if (dict == nullptr) {
+                ZSTD_freeCCtx(ctx);
+                return EXIT_FAILURE;
+            }
+            ZSTD_freeCDict(dict);
+            dict_seconds = std::chrono::duration<double>(clock::now() - dict_start).count()
+                * static_cast<double>(old_data.size()) / static_cast<double>(dict_probe.size());
+        }
+
+        // pieces compressed against their regions over what the cover predicts for them
+        auto correction = 1.0;
+        if (!calibrate_old.empty()) {
+            auto cparams = dict_cparams(level, middle.size(), old_data.size());
+            cparams.hashLog = std::max(cparams.hashLog - std::min(cparams.hashLog, calibrate_shift),
+                                       unsigned { ZSTD_HASHLOG_MIN });
+            cparams.chainLog = std::max(cparams.chainLog - std::min(cparams.chainLog, calibrate_shift),
+                                        unsigned { ZSTD_CHAINLOG_MIN });
+            auto const dict = create_dict(calibrate_old, cparams, threads);
+            if (dict == nullptr) {
+                ZSTD_freeCCtx(ctx);
+                return EXIT_FAILURE;
+            }
+            auto const actual_size = ZSTD_compress_usingCDict(ctx, calibrate_buffer.data(), calibrate_buffer.size(),
+                                                              calibrate.data(), calibrate.size(), dict);
+            ZSTD_freeCDict(dict);
+            auto const novel_out_size = calibrate_novel.empty() || ZSTD_isError(actual_size)
+                ? std::size_t {}
+                : ZSTD_compressCCtx(ctx, calibrate_buffer.data(), calibrate_buffer.size(),
+                                    calibrate_novel.data(), calibrate_novel.size(), level);
+            if (auto const error = ZSTD_isError(actual_size) ? actual_size : novel_out_size; ZSTD_isError(error)) {
+                ZSTD_freeCCtx(ctx);
+                return exit_zstd_error("compress calibration", error);
+            }
+            auto const predicted_size = static_cast<double>(novel_out_size)
+                + static_cast<double>(calibrate_cover.match_count) * estimate_match_cost;
+            correction = static_cast<double>(actual_size) / std::max(predicted_size, 1.0);
+        }
+
+        auto const size = (static_cast<double>(out_size)
+                           + static_cast<double>(cover.match_count) * estimate_match_cost) * scale * correction;
+        auto const seconds = dict_seconds + (novel_size + covered_size * estimate_covered_cost) / (rate * workers);
+        ::printf("%5d  %9.0f  %7.1f\n", level, size, seconds);
+    }
+    ZSTD_freeCCtx(ctx);
+    ::printf("Estimated in %.2fs\n", std::chrono::duration<double>(clock::now() - start).count());
+    return EXIT_SUCCESS;
+}
+
+struct BatchTarget {
+    char const* path_new;
+    char const* path_diff;
+    MMap<char const> map_new = {};
+    MMap<char> map_diff = {};
+    std::size_t out_size = {};
+};
+
+// diff many new files against one old file, dict is loaded once and contexts are reused across targets
+// every worker compresses whole targets as single frames with the dict attached to its context
+static int zst_diff_batch(std::filesystem::path const& path_old,
+                          std::vector<BatchTarget>& targets,
+                          DiffOptions const& options) noexcept {
+    auto map_old = MMap<char const>();
+    ::printf("Maping old file...\n");
+    if (auto error = map_old.open(path_old, options.old_map)) {
+        return exit_mmap_error("open old file", error);
+    }
+
+    // diff files that were already created are left empty on failure
+    auto const discard_diffs = [&] () noexcept {
+        for (auto& target : targets) {
+            [[maybe_unused]] auto const unused_ = target.map_diff.close(0);
+        }
+    };
+
+    // everything gets mapped upfront so workers only compress
+    auto in_total = std::size_t{};
+    auto new_size_max = std::size_t{};
+    ::printf("Maping %zu new and diff files...\n", targets.size());
+    for (auto& target : targets) {
+        if (auto error = target.map_new.open(target.path_new)) {
+            discard_diffs();
+            return exit_mmap_error("open new file", error);
+        }
+        advise_access(target.map_new.span(), MMapAccess::sequential);
+        if (auto error = target.map_diff.create(target.path_diff, ZSTD_compressBound(target.map_new.size()))) {
+            discard_diffs();
+            return exit_mmap_error("create diff file", error);
+        }
+        in_total += target.map_new.size();
+        new_size_max = std::max(new_size_max, target.map_new.size());
+    }
+
+    auto const cparams = dict_cparams(options.level, new_size_max, map_old.size());
+    auto map_index = MMap<char const>();
+    auto const dict = prepare_dict(map_index, map_old.span(), cparams, options);
+    if (dict == nullptr) {
+        discard_diffs();
+        return EXIT_FAILURE;
+    }
+
+    auto const threads = static_cast<unsigned>(std::clamp(std::size_t { options.threads }, std::size_t { 1 }, targets.size()));
+    auto pool = ContextPool();
+    if (auto const result = pool.create(threads, dict, cparams.windowLog)) {
+        ZSTD_freeCDict(dict);
+        discard_diffs();
+        return result;
+    }
+
+    ::printf("Compress start with %u threads...\n", threads);
+    auto in_done = std::atomic<std::size_t> {};
+    auto const error = run_jobs(pool.contexts.size(), targets.size(), in_done, in_total,
+                                [&] (std::size_t worker, std::size_t index) noexcept {
+        auto& target = targets[index];
+        auto last_pos = std::size_t{};
+        auto const result = compress_frame(pool.contexts[worker], dict,
+                                           target.map_new.data(), target.map_new.size(),
+                                           target.map_diff.data(), target.map_diff.size(),
+                                           [&] (std::size_t in_pos) noexcept {
+            in_done += in_pos - last_pos;
+            last_pos = in_pos;
+        });
+        target.out_size = ZSTD_isError(result) ? 0 : result;
+        return result;
+    });
+    ZSTD_freeCDict(dict);
+    ::printf("\n");
+    if (error) {
+        discard_diffs();
+        return exit_zstd_error("compress file", error);
+    }
+
+    // truncate and close the files
+    ::printf("Flush diff files...\n");
+    for (auto& target : targets) {
+        if (auto error = target.map_diff.close(target.out_size)) {
+            return exit_mmap_error("close diff file", error);
+        }
+        ::printf("%s: %llu -> %llu\n", target.path_diff,
+                 static_cast<unsigned long long>(target.map_new.size()),
+                 static_cast<unsigned long long>(target.out_size));
+    }
+    ::printf("Done!\n");
+    return EXIT_SUCCESS;
+}
+struct FanInBase {
+    char const* path_old;
+    char const* path_diff;
+    std::size_t old_size = {};
+    std::size_t out_size = {};
+    double dict_seconds = {};
+    double compress_seconds = {};
+    bool failed = {};
+};
+
+// diff shared new file against one base with its own dict and context, same output as a plain run
+static int diff_fan_in_base(FanInBase& base,
+                            MMap<char const> const& map_new,
+                            int level,
+                            MMapOptions const& old_map,
+                            std::atomic<std::size_t>& in_done,
+                            std::size_t& in_counted) noexcept {
+    using clock = std::chrono::steady_clock;
+    auto const start = clock::now();
+    auto map_old = MMap<char const>();
+    if (auto error = map_old.open(base.path_old, old_map)) {
+        return exit_mmap_error("open old file", error);
+    }
+    base.old_size = map_old.size();
+    auto const dict = create_dict(map_old.span(), dict_cparams(level, map_new.size(), map_old.size()), 1);
+    if (dict == nullptr) {
+        return EXIT_FAILURE;
+    }
+    auto const ctx = ZSTD_createCCtx();
+    if (ctx == nullptr) {
+        ZSTD_freeCDict(dict);
+        return exit_other_error("allocate compress context");
+    }
+    auto map_diff = MMap<char>();
+    if (auto error = map_diff.create(base.path_diff, ZSTD_compressBound(map_new.size()))) {
+        ZSTD_freeCCtx(ctx);
+        ZSTD_freeCDict(dict);
+        return exit_mmap_error("create diff file", error);
+    }
+    auto const dict_done = clock::now();
+
+    auto const out_pos = compress_frame(ctx, dict,
+                                        map_new.data(), map_new.size(),
+                                        map_diff.data(), map_diff.size(),
+                                        [&] (std::size_t in_pos) noexcept {
+        in_done += in_pos - in_counted;
+        in_counted = in_pos;
+    });
+    ZSTD_freeCCtx(ctx);
+    ZSTD_freeCDict(dict);
+    if (ZSTD_isError(out_pos)) {
+        [[maybe_unused]] auto const unused_ = map_diff.close(0);
+        return exit_zstd_error("compress file", out_pos);
+    }
+    if (auto error = map_diff.close(out_pos)) {
+        return exit_mmap_error("close diff file", error);
+    }
+    base.out_size = out_pos;
+    base.dict_seconds = std::chrono::duration<double>(dict_done - start).count();
+    base.compress_seconds = std::chrono::duration<double>(clock::now() - dict_done).count();
+    return EXIT_SUCCESS;
+}
+
+// diff one new file against many bases, new file is mapped once and its pages stay hot for all workers
+// each worker takes whole bases, a failing base is reported in the summary without stopping the others
+static int zst_diff_fan_in(std::filesystem::path const& path_new,
+                           std::vector<FanInBase>& bases,
+                           DiffOptions const& options) noexcept {
+    auto const start = std::chrono::steady_clock::now();
+    auto map_new = MMap<char const>();
+    ::printf("Maping new file...\n");
+    if (auto error = map_new.open(path_new)) {
+        return exit_mmap_error("open new file", error);
+    }
+
+    auto const threads = static_cast<unsigned>(std::clamp(std::size_t { options.threads }, std::size_t { 1 }, bases.size()));
+    ::printf("Compress start against %zu bases with %u threads...\n", bases.size(), threads);
+    auto in_done = std::atomic<std::size_t> {};
+    [[maybe_unused]] auto const unused_ = run_jobs(threads, bases.size(), in_done, map_new.size() * bases.size(),
+                                                   [&] (std::size_t, std::size_t index) noexcept {
+        auto in_counted = std::size_t{};
+        bases[index].failed = diff_fan_in_base(bases[index], map_new, options.level, options.old_map,
+                                                 in_done, in_counted) != EXIT_SUCCESS;
+        // failed bases still count as done so progress ends at zero
+        in_done += map_new.size() - in_counted;
+        return std::size_t{};
+    });
+
+    ::printf("\nSummary:\n");
+    auto failed = false;
+    for (auto const& base : bases) {
+        if (base.failed) {
+            ::printf("%s: FAILED\n", base.path_diff);
+            failed = true;
+            continue;
+        }
+        ::printf("%s: %llu -> %llu (%.2f%% of new) dict %.2fs compress %.2fs\n", base.path_diff,
+                 static_cast<unsigned long long>(base.old_size),
+                 static_cast<unsigned long long>(base.out_size),
+                 map_new.size() ? 100.0 * static_cast<double>(base.out_size) / static_cast<double>(map_new.size()) : 0.0,
+                 base.dict_seconds, base.compress_seconds);
+    }
+    ::printf("Total %.2fs\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if (failed) {
+        return exit_other_error("diff against every base");
+    }
+    ::printf("Done!\n");
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    auto options = DiffOptions {};
+    auto args = std::vector<char const*>();
+    for (int i = 1; i != argc; ++i) {
+        auto const arg = std::string_view { argv[i] };
+        if (arg.starts_with("-T") && arg.size() > 2) {
+            options.threads = static_cast<unsigned>(::atoi(argv[i] + 2));
+        } else if (arg == "--single-frame") {
+            options.single_frame = true;
+        } else if (arg == "--long") {
+            options.long_distance = true;
+        } else if (arg.starts_with("--index=") && arg.size() > 8) {
+            options.index_path = argv[i] + 8;
+        } else if (arg == "--batch") {
+            options.batch = true;
+        } else if (arg == "--estimate") {
+            options.estimate = true;
+        } else if (arg == "--fan-in") {
+            options.fan_in = true;
+        } else if (arg == "--copy-chunks") {
+            options.copy_chunks = true;
+            options.single_frame = true;
+        } else if (arg == "--suffix-array") {
+            options.suffix_array = true;
+            options.single_frame = true;
+        } else if (arg == "--byte-diff") {
+            options.byte_diff = true;
+        } else if (arg == "--branch-filter") {
+            options.branch_filter = true;
+        } else if (arg == "--trim") {
+            options.trim = true;
+        } else if (arg.starts_with("--time-budget=") && arg.size() > 14) {
+            options.time_budget = std::max(::atof(argv[i] + 14), 0.001);
+        } else if (arg == "--adaptive") {
+            options.adaptive = true;
+        } else if (arg == "--give-up") {
+            options.give_up = true;
+        } else if (arg == "--populate") {
+            options.old_map.populate = true;
+        } else if (arg == "--mlock") {
+            options.old_map.lock = true;
+        } else if (arg == "--huge-pages") {
+            options.old_map.huge_pages = true;
+        } else if (arg.starts_with("--map-window=") && arg.size() > 13) {
+            options.map_window = static_cast<std::size_t>(std::clamp(::atoi(argv[i] + 13), 1, 1024)) << 20;
+        } else if (arg == "--read=mmap") {
+            options.new_read = ReadBackend::mmap;
+        } else if (arg == "--read=pread") {
+            options.new_read = ReadBackend::pread;
+        } else if (arg == "--read=direct") {
+            options.new_read = ReadBackend::direct;
+        } else if (arg == "--windowed") {
+            options.windowed = true;
+        } else if (arg.starts_with("--windowed=") && arg.size() > 11) {
+            // at least a few chunks per window, segment behind the dict has to fit into the window too
+            options.windowed = true;
+            options.window_max = static_cast<std::uint64_t>(std::clamp(::atoi(argv[i] + 11), 1, 1024)) << 20;
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    // reads ahead go through windows too, as many as a stream round holds unless told otherwise
+    if (options.new_read != ReadBackend::mmap && options.map_window == 0) {
+        options.map_window = std::max(options.threads, 1u) * stream_segment_size;
+    }
+    if (options.estimate) {
+        // both files get mapped, nothing gets written
+        if (args.size() != 2 || options.batch || options.fan_in || options.map_window != 0
+            || std::string_view { args[1] } == "-") {
+            return exit_bad_args();
+        }
+        return zst_estimate(args[0], args[1], options);
+    }
+    if (options.batch) {
+        // old file followed by new/diff pairs, an odd one out at the end is the level
+        if (args.size() < 3 || options.fan_in || options.single_frame || options.long_distance || options.windowed
+            || options.byte_diff || options.branch_filter || options.trim || options.time_budget > 0
+            || options.adaptive || options.give_up || options.map_window != 0) {
+            return exit_bad_args();
+        }
+        if (args.size() % 2 == 0) {
+            options.level = ::atoi(args.back());
+            args.pop_back();
+        }
+        auto targets = std::vector<BatchTarget>();
+        for (std::size_t i = 1; i + 1 < args.size(); i += 2) {
+            targets.push_back({ args[i], args[i + 1] });
+        }
+        return zst_diff_batch(args[0], targets, options);
+    }
+    if (options.fan_in) {
+        // new file followed by old/diff pairs, an odd one out at the end is the level
+        if (args.size() < 3 || options.single_frame || options.long_distance || options.index_path != nullptr
+            || options.windowed || options.byte_diff || options.branch_filter || options.trim
+            || options.time_budget > 0 || options.adaptive || options.give_up || options.map_window != 0) {
+            return exit_bad_args();
+        }
+        if (args.size() % 2 == 0) {
+            options.level = ::atoi(args.back());
+            args.pop_back();
+        }
+        auto bases = std::vector<FanInBase>();
+        for (std::size_t i = 1; i + 1 < args.size(); i += 2) {
+            bases.push_back({ args[i], args[i + 1] });
+        }
+        return zst_diff_fan_in(args[0], bases, options);
+    }
+    if (args.size() != 3 && args.size() != 4) {
+        return exit_bad_args();
+    }
+    // long distance matching needs the prefix in every job, zstd can only match that single threaded,
+    // and its tables over the prefix live in the context so there is no dict to index either
+    if (options.long_distance && (options.single_frame || options.index_path != nullptr)) {
+        return exit_bad_args();
+    }
+    // suffix array search has no dict tables to index
+    if (options.suffix_array && options.index_path != nullptr) {
+        return exit_bad_args();
+    }
+    // every segment has a dict of its own, neither one shared dict nor one frame fits that
+    if (options.windowed && (options.long_distance || options.single_frame || options.index_path != nullptr)) {
+        return exit_bad_args();
+    }
+    // extents are relative to one frame holding all of new file, with one dict over all of old file
+    if (options.byte_diff && (options.long_distance || options.single_frame || options.windowed)) {
+        return exit_bad_args();
+    }
+    // budget picks levels per segment, every one of these fixes a single level or frame
+    if (options.time_budget > 0 && (options.long_distance || options.single_frame || options.windowed
+                                    || options.byte_diff || options.index_path != nullptr)) {
+        return exit_bad_args();
+    }
+    // segments pick their own level and dict, same as with a budget
+    if (options.adaptive && (options.long_distance || options.single_frame || options.windowed
+                             || options.byte_diff || options.time_budget > 0 || options.index_path != nullptr)) {
+        return exit_bad_args();
+    }
+    // checks run between rounds of segments against one dict, every one of these writes frames its own way
+    if (options.give_up && (options.long_distance || options.single_frame || options.windowed || options.byte_diff
+                            || options.time_budget > 0 || options.adaptive)) {
+        return exit_bad_args();
+    }
+    // one standard frame is all plain zstd decodes, a record in front of it would be skipped
+    if (options.single_frame && (options.trim || options.branch_filter)) {
+        return exit_bad_args();
+    }
+    // pipes cannot be mapped, not even in part
+    if (std::string_view { args[1] } == "-" && options.map_window != 0) {
+        return exit_bad_args();
+    }
+    // stream is only read once from front to back, a segment at a time, so is a mapped window
+    if ((std::string_view { args[1] } == "-" || options.map_window != 0)
+        && (options.long_distance || options.single_frame || options.windowed || options.byte_diff
+            || options.branch_filter || options.trim || options.time_budget > 0 || options.adaptive
+            || options.give_up)) {
         return exit_bad_args();
     }
-    return zst_diff(argv[1], argv[2], argv[3], argc == 5 ? ::atoi(argv[4]) : 0);
+    options.level = args.size() == 4 ? ::atoi(args[3]) : 0;
+    return zst_diff(args[0], args[1], args[2], options);
 }
@@ -1,7 +1,14 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "branch_filter.hpp"
 #include "mmap.hpp"
+#include "records.hpp"
+#include "ring_writer.hpp"
 #include "zstd.h"
 
 static int exit_mmap_error(char const* from, MMapError const& error) noexcept {
@@ -20,11 +27,82 @@ static int exit_other_error(char const* msg) {
     return EXIT_FAILURE;
 }
 
+// How new file gets written, mapped or through buffers of its own.
+enum class WriteBackend {
+    mmap = 0,
+    // io_uring where there is one, writes stay steady and there is no flush of everything at the end
+    ring = 1,
+    // same past the page cache
+    direct = 2,
+};
+
 static int exit_bad_args() noexcept {
-    ::fprintf(stderr, "zstpatch <in old file> <in diff file> <out new file>\n");
+    ::fprintf(stderr, "zstpatch [--populate] [--mlock] [--huge-pages] [--map-window=<MB>] [--write=mmap|ring|direct] <in old file> <in diff file> <out new file>\n");
     return EXIT_FAILURE;
 }
 
+// adds old bytes back to the extents of a frame output that hold the difference to them, false if one is out of range
+static bool add_extents(std::span<char const> old_data, std::span<char> frame_out,
+                        std::vector<DiffExtent> const& extents) noexcept {
+    for (auto const& extent : extents) {
+        if (extent.new_pos > frame_out.size() || extent.size > frame_out.size() - extent.new_pos
+            || extent.old_pos > old_data.size() || extent.size > old_data.size() - extent.old_pos) {
+            return false;
+        }
+        auto const old = old_data.data() + extent.old_pos;
+        auto const dst = frame_out.data() + extent.new_pos;
+        for (std::size_t i = 0; i != extent.size; ++i) {
+            dst[i] = static_cast<char>(static_cast<unsigned char>(dst[i]) + static_cast<unsigned char>(old[i]));
+        }
+    }
+    return true;
+}
+
+// extents have to lie inside old file, where they end in the frame output is only known once it is done
+static bool extents_in_old(std::span<char const> old_data, std::vector<DiffExtent> const& extents) noexcept {
+    return std::all_of(extents.begin(), extents.end(), [&] (DiffExtent const& extent) noexcept {
+        return extent.old_pos <= old_data.size() && extent.size <= old_data.size() - extent.old_pos;
+    });
+}
+
+// adds old bytes back where extents overlap a part of frame output starting at part_pos in the frame,
+// extents are sorted so next is the first one not done yet, it stays on one that goes on past the part
+static void add_extents_part(std::span<char const> old_data, std::span<char> part, std::uint64_t part_pos,
+                             std::vector<DiffExtent> const& extents, std::size_t& next) noexcept {
+    auto const part_end = part_pos + part.size();
+    for (; next != extents.size(); ++next) {
+        auto const& extent = extents[next];
+        auto const begin = std::max(extent.new_pos, part_pos);
+        auto const end = std::min(extent.new_pos + extent.size, part_end);
+        for (auto i = begin; i < end; ++i) {
+            auto& dst = part[i - part_pos];
+            dst = static_cast<char>(static_cast<unsigned char>(dst)
+                                    + static_cast<unsigned char>(old_data[extent.old_pos + (i - extent.new_pos)]));
+        }
+        if (extent.new_pos + extent.size > part_end) {
+            break;
+        }
+    }
+}
+
+// views stay inside one window sized part of new file, so the window only moves on once that part is written
+static std::size_t window_part(MMapWindow<char> const& window, std::uint64_t pos, std::uint64_t size) noexcept {
+    return static_cast<std::size_t>(std::min<std::uint64_t>(window.window_size() - pos % window.window_size(), size));
+}
+
+static MMapError write_windowed(MMapWindow<char>& window, std::uint64_t pos, std::span<char const> src) noexcept {
+    while (!src.empty()) {
+        auto dst = std::span<char> {};
+        if (auto error = window.view(pos, window_part(window, pos, src.size()), dst)) {
+            return error;
+        }
+        std::copy_n(src.data(), dst.size(), dst.data());
+        pos += dst.size();
+        src = src.subspan(dst.size());
+    }
+    return {};
+}
+
 static void print_progress(std::size_t done, std::size_t total) {
     constexpr char const* const unit_name[] = {
         "B", "KB", "MB", "GB",
@@ -41,22 +119,82 @@ static void print_progress(std::size_t done, std::size_t total) {
              unit_name[unit_index]);
 }
 
+// frame is streamed instead of decoded in place, the context keeps the history its matches reach back into,
+// so new file only has to be in place where output goes right now, extents get added as their part comes out,
+// reserve hands out room for output at a position and commit takes what got decoded into it
+template <typename Reserve, typename Commit>
+static int decompress_streamed(ZSTD_DCtx* ctx, ZSTD_DDict const* dict,
+                               std::span<char const> diff, std::size_t& in_pos, std::uint64_t& out_pos,
+                               std::span<char const> old_data, std::vector<DiffExtent> const* extents,
+                               Reserve&& reserve, Commit&& commit) noexcept {
+    ZSTD_DCtx_reset(ctx, ZSTD_reset_session_only);
+    // windows of frames against a large old file are as large as their dict, history buffer only takes
+    // as much of that as the frame content size though
+    if (auto const error = ZSTD_DCtx_setParameter(ctx, ZSTD_d_windowLogMax, ZSTD_WINDOWLOG_MAX);
+            ZSTD_isError(error)) {
+        return exit_zstd_error("set window limit", error);
+    }
+    if (auto const error = ZSTD_DCtx_refDDict(ctx, dict); ZSTD_isError(error)) {
+        return exit_zstd_error("reference dictionary", error);
+    }
+    auto const frame_pos = out_pos;
+    auto next_extent = std::size_t {};
+    auto in = ZSTD_inBuffer { diff.data(), diff.size(), in_pos };
+    for (auto left = std::size_t { 1 }; left != 0;) {
+        auto dst = std::span<char> {};
+        if (auto error = reserve(out_pos, dst)) {
+            return exit_mmap_error("write new file", error);
+        }
+        auto out = ZSTD_outBuffer { dst.data(), dst.size(), 0 };
+        auto const in_before = in.pos;
+        left = ZSTD_decompressStream(ctx, &out, &in);
+        if (ZSTD_isError(left)) {
+            return exit_zstd_error("decompress stream", left);
+        }
+        if (extents) {
+            add_extents_part(old_data, dst.first(out.pos), out_pos - frame_pos, *extents, next_extent);
+        }
+        if (auto error = commit(out.pos)) {
+            return exit_mmap_error("write new file", error);
+        }
+        out_pos += out.pos;
+        // stuck with a frame left means it ends early or outgrows the content size
+        if (left != 0 && out.pos == 0 && in.pos == in_before) {
+            return exit_other_error("decompress stream, frame does not fit diff or new file");
+        }
+        print_progress(in.pos, diff.size());
+    }
+    in_pos = in.pos;
+    if (extents && next_extent != extents->size()) {
+        return exit_other_error("add old bytes back, extent is outside of frame");
+    }
+    return EXIT_SUCCESS;
+}
+
+// old_map applies to old file, matches read it wherever they point
+// map_window maps new file that many bytes at a time instead of whole, 0 maps it whole,
+// any write other than mmap leaves new file unmapped
 static int zst_patch(std::filesystem::path const& path_old,
                      std::filesystem::path const& path_diff,
-                     std::filesystem::path const& path_new) noexcept {
+                     std::filesystem::path const& path_new,
+                     MMapOptions const& old_map,
+                     std::size_t map_window,
+                     WriteBackend write) noexcept {
     // mmap old file
     auto map_old = MMap<char const>();
     ::printf("Mapping old file...\n");
-    if (auto error = map_old.open(path_old)) {
+    if (auto error = map_old.open(path_old, old_map)) {
         return exit_mmap_error("open old file", error);
     }
+    advise_access(map_old.span(), MMapAccess::random);
 
-    // mmap diff file
+    // mmap diff file, it is read once front to back
     auto map_diff = MMap<char const>();
     ::printf("Mapping diff file...\n");
     if (auto error = map_diff.open(path_diff)) {
         return exit_mmap_error("create diff file", error);
     }
+    advise_access(map_diff.span(), MMapAccess::sequential);
 
     // create context and set correct params for buffer-less compression(no internal copies)
     auto const ctx = ZSTD_createDCtx();
@@ -64,9 +202,38 @@ static int zst_patch(std::filesystem::path const& path_old,
         return exit_other_error("allocate compress context");
     }
 
+    // filtered diffs were made against a filtered copy of old file, everything then reads from that
+    auto old_data = map_old.span();
+    auto filtered_old = std::vector<char>();
+    auto const first_record = read_record(map_diff.span());
+    auto const branch_filter = first_record && first_record->kind == RecordKind::branch_filter;
+    auto const ring = write != WriteBackend::mmap;
+    if (branch_filter && (map_window != 0 || ring)) {
+        return exit_other_error("unfilter branches, it needs all of new file mapped at once");
+    }
+    if (branch_filter) {
+        ::printf("Filtering old file branches...\n");
+        filtered_old.assign(old_data.begin(), old_data.end());
+        filter_branches(filtered_old, find_code_sections(old_data));
+        old_data = filtered_old;
+    }
+
+    // start and end that new file shares with old file are copied, frames only hold the middle
+    std::size_t in_pos = branch_filter ? first_record->frame_size : 0;
+    auto affix = CommonAffix {};
+    if (auto const record = read_record(map_diff.span().subspan(in_pos));
+            record && record->kind == RecordKind::common_affix) {
+        auto const read = read_common_affix(*record);
+        if (!read || read->prefix_size > old_data.size() || read->suffix_size > old_data.size()) {
+            return exit_other_error("read common prefix and suffix, it is outside of old file");
+        }
+        affix = *read;
+        in_pos += record->frame_size;
+    }
+
     // create new dict by reference(no copies)
     ::printf("Loading dictionary...\n");
-    auto const dict = ZSTD_createDDict_advanced(map_old.data(), map_old.size(),
+    auto const dict = ZSTD_createDDict_advanced(old_data.data(), old_data.size(),
                                                 ZSTD_dlm_byRef,
                                                 ZSTD_dct_rawContent,
                                                 {});
@@ -74,53 +241,212 @@ static int zst_patch(std::filesystem::path const& path_old,
         return exit_other_error("create dictionary");
     }
 
-    // mmap new file
-    auto const new_size_ex = ZSTD_getFrameContentSize(map_diff.data(), map_diff.size());
-    if (new_size_ex == ZSTD_CONTENTSIZE_UNKNOWN) {
-        // TODO: we would need to stream without specific content size
-        // this is not desirable as we are potentialy dealing with very large dictionary/old files
-        // Solution 1: use some heuristic to fallback to streaming mode for small-ish files
-        // Solution 2: implement growable mmaps
-        return exit_other_error("get content size, there is no content size");
+    // mmap new file, diff can be a concatenation of frames
+    // streaming encoders leave out the content size, new file then starts at the size of the diff and grows,
+    // written front to back it just ends wherever the frames do
+    auto const new_size_ex = ZSTD_findDecompressedSize(map_diff.data(), map_diff.size());
+    auto const growable = new_size_ex == ZSTD_CONTENTSIZE_UNKNOWN;
+    if (growable && map_window != 0) {
+        return exit_other_error("get content size, a map window needs one in every frame");
     }
-    if (ZSTD_isError(new_size_ex)) {
+    if (!growable && ZSTD_isError(new_size_ex)) {
         return exit_zstd_error("extract content size", new_size_ex);
     }
+    auto const new_size = affix.prefix_size + (growable ? map_diff.size() : new_size_ex) + affix.suffix_size;
     auto map_new = MMap<char>();
-    ::printf("Mapping new file...\n");
-    if (auto error = map_new.create(path_new, new_size_ex)) {
+    auto window_new = MMapWindow<char>();
+    auto ring_new = RingWriter();
+    ::printf(ring ? "Creating new file...\n" : "Mapping new file...\n");
+    if (auto error = ring ? ring_new.create(path_new, write == WriteBackend::direct)
+            : map_window != 0 ? window_new.create(path_new, new_size, map_window)
+            : map_new.create(path_new, new_size)) {
         return exit_mmap_error("open new file", error);
     }
-
-    // do decompression
-    std::size_t in_pos = 0;
-    std::size_t out_pos = 0;
-    if (auto const error = ZSTD_decompressBegin_usingDDict(ctx, dict); ZSTD_isError(error)) {
-        return exit_zstd_error("begin decompress", error);
+    advise_access(map_new.span(), MMapAccess::sequential);
+    auto frames_end = new_size - affix.suffix_size;
+    if (ring) {
+        if (auto error = ring_new.write(old_data.first(affix.prefix_size))) {
+            return exit_mmap_error("write common prefix", error);
+        }
+    } else if (map_window != 0) {
+        if (auto error = write_windowed(window_new, 0, old_data.first(affix.prefix_size))) {
+            return exit_mmap_error("write common prefix", error);
+        }
+    } else {
+        std::copy_n(old_data.data(), affix.prefix_size, map_new.data());
     }
+
+    // do decompression, every frame starts over from the same dict
+    // unless a record in front of it narrows the dict down to a window of the old file,
+    // another record can mark extents of its output that still need old bytes added back
+    std::uint64_t out_pos = affix.prefix_size;
+    auto window = std::optional<DictWindow> {};
+    auto extents = std::optional<std::vector<DiffExtent>> {};
     ::printf("Decompress start...\n");
-    while (auto const next_in_size = ZSTD_nextSrcSizeToDecompress(ctx)) {
-        if (ZSTD_isError(next_in_size)) {
-            ::printf("\n");
-            return exit_zstd_error("next in size", next_in_size);
+    while (in_pos != map_diff.size()) {
+        if (auto const record = read_record(map_diff.span().subspan(in_pos))) {
+            if (record->kind == RecordKind::dict_window) {
+                window = read_dict_window(*record);
+                if (!window) {
+                    ::printf("\n");
+                    return exit_other_error("read dictionary window");
+                }
+                if (window->old_pos > old_data.size() || window->old_size > old_data.size() - window->old_pos) {
+                    ::printf("\n");
+                    return exit_other_error("read dictionary window, it is outside of old file");
+                }
+            } else if (record->kind == RecordKind::byte_diff) {
+                extents = read_byte_diff(*record, new_size);
+                if (!extents) {
+                    ::printf("\n");
+                    return exit_other_error("read byte difference extents");
+                }
+                if (!extents_in_old(old_data, *extents)) {
+                    ::printf("\n");
+                    return exit_other_error("read byte difference extents, extent is outside of old file");
+                }
+            } else if (record->kind == RecordKind::branch_filter) {
+                ::printf("\n");
+                return exit_other_error("read branch filter, it only goes at the start");
+            } else if (record->kind == RecordKind::common_affix) {
+                ::printf("\n");
+                return exit_other_error("read common prefix and suffix, it only goes at the start");
+            } else {
+                ::printf("\n");
+                return exit_other_error("read record, unknown kind");
+            }
+            in_pos += record->frame_size;
+            continue;
         }
-        auto const left_in_size = map_diff.size() - in_pos;
-        auto const actual_in_size = std::min(next_in_size, left_in_size);
+        auto const frame_pos = out_pos;
+        // window dict only references its part of the old mapping, only those pages get read
+        auto window_dict = static_cast<ZSTD_DDict*>(nullptr);
+        if (window) {
+            advise_access(old_data.subspan(window->old_pos, window->old_size), MMapAccess::willneed);
+            window_dict = ZSTD_createDDict_advanced(old_data.data() + window->old_pos, window->old_size,
+                                                    ZSTD_dlm_byRef,
+                                                    ZSTD_dct_rawContent,
+                                                    {});
+            if (window_dict == nullptr) {
+                ::printf("\n");
+                return exit_other_error("create window dictionary");
+            }
+            window.reset();
+        }
+        if (ring || map_window != 0) {
+            auto const result = ring
+                ? decompress_streamed(ctx, window_dict ? window_dict : dict, map_diff.span(), in_pos, out_pos,
+                                      old_data, extents ? &*extents : nullptr,
+                                      [&] (std::uint64_t, std::span<char>& dst) noexcept {
+                                          return ring_new.reserve(dst);
+                                      },
+                                      [&] (std::size_t size) noexcept {
+                                          return ring_new.commit(size);
+                                      })
+                : decompress_streamed(ctx, window_dict ? window_dict : dict, map_diff.span(), in_pos, out_pos,
+                                      old_data, extents ? &*extents : nullptr,
+                                      [&] (std::uint64_t pos, std::span<char>& dst) noexcept {
+                                          return window_new.view(pos, window_part(window_new, pos, frames_end - pos),
+                                                                 dst);
+                                      },
+                                      [] (std::size_t) noexcept {
+                                          return MMapError {};
+                                      });
+            ZSTD_freeDDict(window_dict);
+            extents.reset();
+            if (result != EXIT_SUCCESS) {
+                ::printf("\n");
+                return result;
+            }
+            continue;
+        }
+        // output is decoded in place and matches reference it where it was written, so when growing moves
+        // the mapping in the middle of a frame that frame starts over, growth is geometric so that stays rare
+        auto const frame_in_pos = in_pos;
+        for (auto restart = true; restart;) {
+            restart = false;
+            in_pos = frame_in_pos;
+            out_pos = frame_pos;
+            if (auto const error = ZSTD_decompressBegin_usingDDict(ctx, window_dict ? window_dict : dict);
+                    ZSTD_isError(error)) {
+                ::printf("\n");
+                return exit_zstd_error("begin decompress", error);
+            }
+            while (auto const next_in_size = ZSTD_nextSrcSizeToDecompress(ctx)) {
+                if (ZSTD_isError(next_in_size)) {
+                    ::printf("\n");
+                    return exit_zstd_error("next in size", next_in_size);
+                }
+                if (growable) {
+                    // room for the largest block there can be
+                    auto const data_before = map_new.data();
+                    if (auto error = map_new.grow(out_pos + ZSTD_BLOCKSIZE_MAX)) {
+                        ::printf("\n");
+                        return exit_mmap_error("grow new file", error);
+                    }
+                    frames_end = map_new.size();
+                    if (map_new.data() != data_before && out_pos != frame_pos) {
+                        restart = true;
+                        break;
+                    }
+                }
+                auto const left_in_size = map_diff.size() - in_pos;
+                auto const actual_in_size = std::min(next_in_size, left_in_size);
 
-        auto const left_out_size = map_new.size() - out_pos;
-        auto const next_out_size = ZSTD_decompressContinue(ctx,
-                                                           map_new.data() + out_pos, left_out_size,
-                                                           map_diff.data() + in_pos, actual_in_size);
-        if (ZSTD_isError(next_out_size)) {
+                auto const left_out_size = frames_end - out_pos;
+                auto const next_out_size = ZSTD_decompressContinue(ctx,
+                                                                   map_new.data() + out_pos, left_out_size,
+                                                                   map_diff.data() + in_pos, actual_in_size);
+                if (ZSTD_isError(next_out_size)) {
+                    ::printf("\n");
+                    return exit_zstd_error("decompress continue", next_out_size);
+                }
+                in_pos += next_in_size;
+                out_pos += next_out_size;
+                print_progress(in_pos, map_diff.size());
+            }
+        }
+        ZSTD_freeDDict(window_dict);
+        if (extents) {
+            if (!add_extents(old_data, map_new.span().subspan(frame_pos, out_pos - frame_pos), *extents)) {
+                ::printf("\n");
+                return exit_other_error("add old bytes back, extent is outside of old file or frame");
+            }
+            extents.reset();
+        }
+    }
+    auto const suffix = old_data.last(affix.suffix_size);
+    if (ring) {
+        frames_end = out_pos;
+    } else if (growable) {
+        frames_end = out_pos;
+        if (auto error = map_new.grow(frames_end + suffix.size())) {
             ::printf("\n");
-            return exit_zstd_error("decompress continue", next_out_size);
+            return exit_mmap_error("grow new file", error);
         }
-        in_pos += next_in_size;
-        out_pos += next_out_size;
-        print_progress(in_pos, map_diff.size());
+    }
+    auto const new_end = frames_end + suffix.size();
+    if (ring) {
+        if (auto error = ring_new.write(suffix)) {
+            ::printf("\n");
+            return exit_mmap_error("write common suffix", error);
+        }
+    } else if (map_window != 0) {
+        if (auto error = write_windowed(window_new, frames_end, suffix)) {
+            ::printf("\n");
+            return exit_mmap_error("write common suffix", error);
+        }
+    } else {
+        std::copy_n(suffix.data(), suffix.size(), map_new.data() + frames_end);
+    }
+    if (branch_filter) {
+        // headers are never filtered, so the output still shows where its code sections are
+        ::printf("\nUnfiltering new file branches...");
+        filter_branches(map_new.span().first(new_end), find_code_sections(map_new.span().first(new_end)));
     }
     ::printf("\nFlush new file...\n");
-    if (auto error = map_new.close()) {
+    // a grown file is cut back to what got written, the ring only waits for the writes still in flight
+    if (auto error = ring ? ring_new.close() : map_window != 0 ? window_new.close() : map_new.close(new_end)) {
         return exit_mmap_error("close new file", error);
     }
     ::printf("Done!\n");
@@ -133,8 +459,33 @@ static int zst_patch(std::filesystem::path const& path_old,
 
 
 int main(int argc, char** argv) {
-    if (argc != 4) {
+    auto old_map = MMapOptions {};
+    auto map_window = std::size_t {};
+    auto write = WriteBackend::mmap;
+    auto args = std::vector<char const*>();
+    for (int i = 1; i != argc; ++i) {
+        auto const arg = std::string_view { argv[i] };
+        if (arg == "--populate") {
+            old_map.populate = true;
+        } else if (arg == "--mlock") {
+            old_map.lock = true;
+        } else if (arg == "--huge-pages") {
+            old_map.huge_pages = true;
+        } else if (arg.starts_with("--map-window=") && arg.size() > 13) {
+            map_window = static_cast<std::size_t>(std::clamp(::atoi(argv[i] + 13), 1, 1024)) << 20;
+        } else if (arg == "--write=mmap") {
+            write = WriteBackend::mmap;
+        } else if (arg == "--write=ring") {
+            write = WriteBackend::ring;
+        } else if (arg == "--write=direct") {
+            write = WriteBackend::direct;
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    // both replace writing through a whole mapping, only one can
+    if (args.size() != 3 || (map_window != 0 && write != WriteBackend::mmap)) {
         return exit_bad_args();
     }
-    return zst_patch(argv[1], argv[2], argv[3]);
+    return zst_patch(args[0], args[1], args[2], old_map, map_window, write);
 }
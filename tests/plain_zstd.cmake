@@ -0,0 +1,32 @@
+# diffs without records have to decode with plain zstd and old file as dict, same as through zstpatch
+# cmake -DZSTDIFF=<zstdiff> -DZSTPATCH=<zstpatch> -DZSTD=<zstd> -DWORK=<dir> -P plain_zstd.cmake
+
+file(MAKE_DIRECTORY ${WORK})
+string(RANDOM LENGTH 65536 ALPHABET "abcdefghij \n" RANDOM_SEED 1 old)
+string(RANDOM LENGTH 300 ALPHABET "klmnop" RANDOM_SEED 2 edit)
+string(SUBSTRING "${old}" 0 30000 head)
+string(SUBSTRING "${old}" 30300 -1 tail)
+file(WRITE ${WORK}/old "${old}")
+file(WRITE ${WORK}/changed "${head}${edit}${tail}")
+file(WRITE ${WORK}/appended "${old}${edit}")
+file(WRITE ${WORK}/identical "${old}")
+
+foreach(new changed appended identical)
+    foreach(mode "" "-T4" "--single-frame" "--single-frame;-T4")
+        execute_process(COMMAND ${ZSTDIFF} ${mode} ${WORK}/old ${WORK}/${new} ${WORK}/diff
+                        RESULT_VARIABLE result OUTPUT_QUIET)
+        if(NOT result EQUAL 0)
+            message(FATAL_ERROR "zstdiff ${mode} ${new} failed")
+        endif()
+        execute_process(COMMAND ${ZSTD} -q -d -f -D ${WORK}/old ${WORK}/diff -o ${WORK}/out RESULT_VARIABLE result)
+        execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${WORK}/${new} ${WORK}/out RESULT_VARIABLE same)
+        if(NOT result EQUAL 0 OR NOT same EQUAL 0)
+            message(FATAL_ERROR "zstd -d -D old does not give ${new} back from zstdiff ${mode}")
+        endif()
+        execute_process(COMMAND ${ZSTPATCH} ${WORK}/old ${WORK}/diff ${WORK}/out RESULT_VARIABLE result OUTPUT_QUIET)
+        execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${WORK}/${new} ${WORK}/out RESULT_VARIABLE same)
+        if(NOT result EQUAL 0 OR NOT same EQUAL 0)
+            message(FATAL_ERROR "zstpatch does not give ${new} back from zstdiff ${mode}")
+        endif()
+    endforeach()
+endforeach()
@@ -14,6 +14,8 @@
 #include "../common/zstd_deps.h"  /* INT_MAX, ZSTD_memset, ZSTD_memcpy */
 #include "../common/cpu.h"
 #include "../common/mem.h"
+#include "../common/pool.h"
+#include "../common/threading.h"
 #include "hist.h"           /* HIST_countFast_wksp */
 #define FSE_STATIC_LINKING_ONLY   /* FSE_encodeSymbol */
 #include "../common/fse.h"
@@ -468,6 +470,11 @@ ZSTD_bounds ZSTD_cParam_getBounds(ZSTD_cParameter param)
         bounds.upperBound = 1;
         return bounds;
 
+    case ZSTD_c_dictLoadWorkers:
+        bounds.lowerBound = 0;
+        bounds.upperBound = ZSTD_DICTWORKERS_MAX;
+        return bounds;
+
     default:
         bounds.error = ERROR(parameter_unsupported);
         return bounds;
@@ -529,6 +536,7 @@ static int ZSTD_isUpdateAuthorized(ZSTD_cParameter param)
     case ZSTD_c_stableOutBuffer:
     case ZSTD_c_blockDelimiters:
     case ZSTD_c_validateSequences:
+    case ZSTD_c_dictLoadWorkers:
     default:
         return 0;
     }
@@ -581,6 +589,7 @@ size_t ZSTD_CCtx_setParameter(ZSTD_CCtx* cctx, ZSTD_cParameter param, int value)
     case ZSTD_c_stableOutBuffer:
     case ZSTD_c_blockDelimiters:
     case ZSTD_c_validateSequences:
+    case ZSTD_c_dictLoadWorkers:
         break;
 
     default: RETURN_ERROR(parameter_unsupported, "unknown parameter");
@@ -792,6 +801,11 @@ size_t ZSTD_CCtxParams_setParameter(ZSTD_CCtx_params* CCtxParams,
         CCtxParams->validateSequences = value;
         return CCtxParams->validateSequences;
 
+    case ZSTD_c_dictLoadWorkers:
+        BOUNDCHECK(ZSTD_c_dictLoadWorkers, value);
+        CCtxParams->dictLoadWorkers = value;
+        return CCtxParams->dictLoadWorkers;
+
     default: RETURN_ERROR(parameter_unsupported, "unknown parameter");
     }
 }
@@ -915,6 +929,9 @@ size_t ZSTD_CCtxParams_getParameter(
     case ZSTD_c_validateSequences :
         *value = (int)CCtxParams->validateSequences;
         break;
+    case ZSTD_c_dictLoadWorkers :
+        *value = CCtxParams->dictLoadWorkers;
+        break;
     default: RETURN_ERROR(parameter_unsupported, "unknown parameter");
     }
     return 0;
@@ -3102,6 +3119,249 @@ size_t ZSTD_compressBlock(ZSTD_CCtx* cctx, void* dst, size_t dstCapacity, const
     return ZSTD_compressContinue_internal(cctx, dst, dstCapacity, src, srcSize, 0 /* frame mode */, 0 /* last chunk */);
 }
 
+/*-*************************************
+*  Dictionary loading workers
+***************************************/
+typedef struct {
+    ZSTD_dictWorkers* workers;
+    unsigned workerID;
+} ZSTD_dictWorkers_slot;
+
+struct ZSTD_dictWorkers_s {
+    POOL_ctx* pool;
+    ZSTD_customMem customMem;
+    unsigned nbWorkers;
+    ZSTD_dictWorkers_slot* slots;
+    ZSTD_dictWorkers_job job;
+    void* opaque;
+    unsigned pending;
+    ZSTD_pthread_mutex_t mutex;
+    ZSTD_pthread_cond_t cond;
+};
+
+ZSTD_dictWorkers* ZSTD_dictWorkers_create(int nbWorkers, ZSTD_customMem customMem)
+{
+#ifdef ZSTD_MULTITHREAD
+    ZSTD_dictWorkers* workers;
+    if (nbWorkers <= 1) return NULL;
+    workers = (ZSTD_dictWorkers*)ZSTD_customCalloc(sizeof(ZSTD_dictWorkers), customMem);
+    if (workers == NULL) return NULL;
+    workers->customMem = customMem;
+    workers->nbWorkers = (unsigned)MIN(nbWorkers, ZSTD_DICTWORKERS_MAX);
+    if (ZSTD_pthread_mutex_init(&workers->mutex, NULL)) {
+        ZSTD_customFree(workers, customMem);
+        return NULL;
+    }
+    if (ZSTD_pthread_cond_init(&workers->cond, NULL)) {
+        ZSTD_pthread_mutex_destroy(&workers->mutex);
+        ZSTD_customFree(workers, customMem);
+        return NULL;
+    }
+    /* the calling thread acts as worker 0 */
+    workers->pool = POOL_create_advanced(workers->nbWorkers - 1, workers->nbWorkers - 1, customMem);
+    workers->slots = (ZSTD_dictWorkers_slot*)ZSTD_customMalloc(workers->nbWorkers * sizeof(ZSTD_dictWorkers_slot), customMem);
+    if (workers->pool == NULL || workers->slots == NULL) {
+        ZSTD_dictWorkers_free(workers);
+        return NULL;
+    }
+    {   unsigned u;
+        for (u = 0; u < workers->nbWorkers; ++u) {
+            workers->slots[u].workers = workers;
+            workers->slots[u].workerID = u;
+    }   }
+    return workers;
+#else
+    (void)nbWorkers; (void)customMem;
+    return NULL;
+#endif
+}
+
+void ZSTD_dictWorkers_free(ZSTD_dictWorkers* workers)
+{
+    if (workers == NULL) return;
+    POOL_free(workers->pool);
+    ZSTD_pthread_mutex_destroy(&workers->mutex);
+    ZSTD_pthread_cond_destroy(&workers->cond);
+    ZSTD_customFree(workers->slots, workers->customMem);
+    ZSTD_customFree(workers, workers->customMem);
+}
+
+unsigned ZSTD_dictWorkers_count(const ZSTD_dictWorkers* workers)
+{
+    return workers == NULL ? 1 : workers->nbWorkers;
+}
+
+ZSTD_customMem ZSTD_dictWorkers_customMem(const ZSTD_dictWorkers* workers)
+{
+    return workers == NULL ? ZSTD_defaultCMem : workers->customMem;
+}
+
+static void ZSTD_dictWorkers_runSlot(void* opaque)
+{
+    ZSTD_dictWorkers_slot* const slot = (ZSTD_dictWorkers_slot*)opaque;
+    ZSTD_dictWorkers* const workers = slot->workers;
+    workers->job(workers->opaque, slot->workerID, workers->nbWorkers);
+    ZSTD_pthread_mutex_lock(&workers->mutex);
+    if (--workers->pending == 0)
+        ZSTD_pthread_cond_signal(&workers->cond);
+    ZSTD_pthread_mutex_unlock(&workers->mutex);
+}
+
+void ZSTD_dictWorkers_run(ZSTD_dictWorkers* workers, ZSTD_dictWorkers_job job, void* opaque)
+{
+    unsigned u;
+    if (workers == NULL) {
+        job(opaque, 0, 1);
+        return;
+    }
+    workers->job = job;
+    workers->opaque = opaque;
+    workers->pending = workers->nbWorkers - 1;
+    for (u = 1; u < workers->nbWorkers; ++u)
+        POOL_add(workers->pool, ZSTD_dictWorkers_runSlot, &workers->slots[u]);
+    job(opaque, 0, workers->nbWorkers);
+    ZSTD_pthread_mutex_lock(&workers->mutex);
+    while (workers->pending != 0)
+        ZSTD_pthread_cond_wait(&workers->cond, &workers->mutex);
+    ZSTD_pthread_mutex_unlock(&workers->mutex);
+}
+
+/* Positions handled by one worker per round in ZSTD_dictFill_parallel() */
+#define ZSTD_DICTFILL_SLICE_SIZE (1 << 18)
+
+typedef struct {
+    const ZSTD_dictFillDesc* desc;
+    U32 roundStart;
+    U32 roundEnd;
+    U32 sliceSize;
+    size_t opsPerSlice;
+    ZSTD_dictFillOp* ops;    /* per worker : generated ops, then the same ops grouped by owner */
+    size_t* ownerStarts;     /* per worker : nbWorkers+1 group boundaries */
+} ZSTD_dictFill_job;
+
+static unsigned ZSTD_dictFill_owner(const ZSTD_dictFillDesc* desc, const ZSTD_dictFillOp* op, unsigned nbWorkers)
+{
+    /* contiguous slot ranges, so owners also split the tables cache friendly */
+    return (unsigned)(((U64)op->slot * nbWorkers) >> desc->tableLogs[op->table]);
+}
+
+static void ZSTD_dictFill_generateSlice(void* opaque, unsigned workerID, unsigned nbWorkers)
+{
+    ZSTD_dictFill_job* const job = (ZSTD_dictFill_job*)opaque;
+    const ZSTD_dictFillDesc* const desc = job->desc;
+    ZSTD_dictFillOp* const generated = job->ops + (size_t)workerID * 2 * job->opsPerSlice;
+    ZSTD_dictFillOp* const grouped = generated + job->opsPerSlice;
+    size_t* const starts = job->ownerStarts + (size_t)workerID * (nbWorkers + 1);
+    U64 const start = (U64)job->roundStart + (U64)workerID * job->sliceSize;
+    size_t nbOps = 0;
+    size_t n;
+    unsigned w;
+    if (start < job->roundEnd) {
+        U32 const end = (U32)MIN(start + job->sliceSize, job->roundEnd);
+        nbOps = desc->generate(desc->opaque, (U32)start, end, desc->step, generated);
+        assert(nbOps <= job->opsPerSlice);
+    }
+    /* stable counting sort by owner, each owner keeps the position order */
+    ZSTD_memset(starts, 0, (nbWorkers + 1) * sizeof(size_t));
+    for (n = 0; n < nbOps; ++n)
+        starts[ZSTD_dictFill_owner(desc, &generated[n], nbWorkers) + 1]++;
+    for (w = 0; w < nbWorkers; ++w)
+        starts[w + 1] += starts[w];
+    for (n = 0; n < nbOps; ++n)
+        grouped[starts[ZSTD_dictFill_owner(desc, &generated[n], nbWorkers)]++] = generated[n];
+    /* cursors now point at the end of each group, shift them back to group starts */
+    for (w = nbWorkers; w > 0; --w)
+        starts[w] = starts[w - 1];
+    starts[0] = 0;
+}
+
+static void ZSTD_dictFill_applyOwned(void* opaque, unsigned workerID, unsigned nbWorkers)
+{
+    ZSTD_dictFill_job* const job = (ZSTD_dictFill_job*)opaque;
+    const ZSTD_dictFillDesc* const desc = job->desc;
+    unsigned src;
+    for (src = 0; src < nbWorkers; ++src) {
+        const ZSTD_dictFillOp* const grouped = job->ops + ((size_t)src * 2 + 1) * job->opsPerSlice;
+        const size_t* const starts = job->ownerStarts + (size_t)src * (nbWorkers + 1);
+        size_t n;
+        for (n = starts[workerID]; n < starts[workerID + 1]; ++n) {
+            const ZSTD_dictFillOp* const op = &grouped[n];
+            U32* const table = desc->tables[op->table];
+            switch (op->kind)
+            {
+            case ZSTD_dfo_set:
+                table[op->slot] = op->index;
+                break;
+            case ZSTD_dfo_setIfEmpty:
+                if (table[op->slot] == 0)
+                    table[op->slot] = op->index;
+                break;
+            case ZSTD_dfo_push:
+                if (op->index >= desc->chainFrom)
+                    desc->chainTable[op->index & desc->chainMask] = table[op->slot];
+                table[op->slot] = op->index;
+                break;
+            default:
+                assert(0);
+            }
+        }
+    }
+}
+
+int ZSTD_dictFill_parallel(ZSTD_dictWorkers* workers, const ZSTD_dictFillDesc* desc, U32 start, U32 end)
+{
+    unsigned const nbWorkers = ZSTD_dictWorkers_count(workers);
+    ZSTD_customMem const customMem = ZSTD_dictWorkers_customMem(workers);
+    ZSTD_dictFill_job job;
+    assert(desc->step > 0);
+    /* slices stay on the step grid of start */
+    job.sliceSize = ZSTD_DICTFILL_SLICE_SIZE - ZSTD_DICTFILL_SLICE_SIZE % desc->step;
+    if (nbWorkers <= 1 || start >= end || end - start < 2 * job.sliceSize) return 0;
+
+    job.desc = desc;
+    job.opsPerSlice = (size_t)(job.sliceSize / desc->step) * desc->maxOpsPerStep;
+    job.ops = (ZSTD_dictFillOp*)ZSTD_customMalloc((size_t)nbWorkers * 2 * job.opsPerSlice * sizeof(ZSTD_dictFillOp), customMem);
+    job.ownerStarts = (size_t*)ZSTD_customMalloc((size_t)nbWorkers * (nbWorkers + 1) * sizeof(size_t), customMem);
+    if (job.ops == NULL || job.ownerStarts == NULL) {
+        ZSTD_customFree(job.ops, customMem);
+        ZSTD_customFree(job.ownerStarts, customMem);
+        return 0;
+    }
+    DEBUGLOG(4, "ZSTD_dictFill_parallel: %u positions on %u workers", end - start, nbWorkers);
+    for (job.roundStart = start; job.roundStart < end; job.roundStart = job.roundEnd) {
+        job.roundEnd = job.roundStart + (U32)MIN((U64)(end - job.roundStart), (U64)nbWorkers * job.sliceSize);
+        ZSTD_dictWorkers_run(workers, ZSTD_dictFill_generateSlice, &job);
+        ZSTD_dictWorkers_run(workers, ZSTD_dictFill_applyOwned, &job);
+    }
+    ZSTD_customFree(job.ops, customMem);
+    ZSTD_customFree(job.ownerStarts, customMem);
+    return 1;
+}
+
+/*! ZSTD_dictWorkers_useful() :
+ *  Starting the pool only pays off when some table of this load gets filled in parallel :
+ *  the ldm table or the tables of the fast, dfast and hash chain strategies,
+ *  over content spanning at least two slices (ldm slices are as large).
+ *  Binary trees and the dedicated dict search structure are always built on the calling thread. */
+static int ZSTD_dictWorkers_useful(const ZSTD_matchState_t* ms, const ldmState_t* ls,
+                                   const ZSTD_CCtx_params* params, size_t srcSize)
+{
+    if (params->dictLoadWorkers <= 1 || srcSize < 2 * ZSTD_DICTFILL_SLICE_SIZE) return 0;
+    if (params->ldmParams.enableLdm && ls != NULL) return 1;
+    switch(params->cParams.strategy)
+    {
+    case ZSTD_fast:
+    case ZSTD_dfast:
+        return 1;
+    case ZSTD_greedy:
+    case ZSTD_lazy:
+    case ZSTD_lazy2:
+        return !ms->dedicatedDictSearch;
+    default:
+        return 0;
+    }
+}
+
 /*! ZSTD_loadDictionaryContent() :
  *  @return : 0, or an error code
  */
@@ -3114,6 +3374,7 @@ static size_t ZSTD_loadDictionaryContent(ZSTD_matchState_t* ms,
 {
     const BYTE* ip = (const BYTE*) src;
     const BYTE* const iend = ip + srcSize;
+    ZSTD_dictWorkers* workers;
 
     ZSTD_window_update(&ms->window, src, srcSize);
     ms->loadedDictEnd = params->forceWindow ? 0 : (U32)(iend - ms->window.base);
@@ -3128,6 +3389,10 @@ static size_t ZSTD_loadDictionaryContent(ZSTD_matchState_t* ms,
 
     if (srcSize <= HASH_READ_SIZE) return 0;
 
+    workers = ZSTD_dictWorkers_useful(ms, ls, params, srcSize)
+            ? ZSTD_dictWorkers_create(params->dictLoadWorkers, params->customMem)
+            : NULL;
+
     while (iend - ip > HASH_READ_SIZE) {
         size_t const remaining = (size_t)(iend - ip);
         size_t const chunk = MIN(remaining, ZSTD_CHUNKSIZE_MAX);
@@ -3135,16 +3400,19 @@ static size_t ZSTD_loadDictionaryContent(ZSTD_matchState_t* ms,
 
         ZSTD_overflowCorrectIfNeeded(ms, ws, params, ip, ichunk);
 
-        if (params->ldmParams.enableLdm && ls != NULL)
-            ZSTD_ldm_fillHashTable(ls, (const BYTE*)src, (const BYTE*)src + srcSize, &params->ldmParams);
+        if (params->ldmParams.enableLdm && ls != NULL) {
+            /* the loop stops short of the last HASH_READ_SIZE bytes, ldm may still index them */
+            const BYTE* const ldmEnd = (size_t)(iend - ichunk) > HASH_READ_SIZE ? ichunk : iend;
+            ZSTD_ldm_fillHashTableChunk(ls, (const BYTE*)src, iend, ip, ldmEnd, &params->ldmParams, workers);
+        }
 
         switch(params->cParams.strategy)
         {
         case ZSTD_fast:
-            ZSTD_fillHashTable(ms, ichunk, dtlm);
+            ZSTD_fillHashTable_parallel(ms, ichunk, dtlm, workers);
             break;
         case ZSTD_dfast:
-            ZSTD_fillDoubleHashTable(ms, ichunk, dtlm);
+            ZSTD_fillDoubleHashTable_parallel(ms, ichunk, dtlm, workers);
             break;
 
         case ZSTD_greedy:
@@ -3154,7 +3422,7 @@ static size_t ZSTD_loadDictionaryContent(ZSTD_matchState_t* ms,
                 assert(chunk == remaining); /* must load everything in one go */
                 ZSTD_dedicatedDictSearch_lazy_loadDictionary(ms, ichunk-HASH_READ_SIZE);
             } else if (chunk >= HASH_READ_SIZE) {
-                ZSTD_insertAndFindFirstIndex(ms, ichunk-HASH_READ_SIZE);
+                ZSTD_updateHashChain_parallel(ms, ichunk-HASH_READ_SIZE, workers);
             }
             break;
 
@@ -3172,6 +3440,7 @@ static size_t ZSTD_loadDictionaryContent(ZSTD_matchState_t* ms,
 
         ip = ichunk;
     }
+    ZSTD_dictWorkers_free(workers);
 
     ms->nextToUpdate = (U32)(iend - ms->window.base);
     return 0;
@@ -3835,6 +4104,159 @@ size_t ZSTD_freeCDict(ZSTD_CDict* cdict)
     }
 }
 
+/* ===== CDict tables persistence ===== */
+
+#define ZSTD_CDICT_TABLES_MAGIC 0x5444435AU   /* "ZCDT" */
+#define ZSTD_CDICT_TABLES_ALIGN 64
+
+typedef struct {
+    U32 magic;
+    U32 versionNumber;
+    U32 headerSize;        /* catches layout changes between builds */
+    U32 blockStateSize;
+    U64 dictContentSize;
+    ZSTD_compressionParameters cParams;
+    U32 dictContentType;
+    U32 dictID;
+    U32 dedicatedDictSearch;
+    U32 dictLimit;
+    U32 lowLimit;
+    U32 nextSrc;           /* window.nextSrc - window.base */
+    U32 nextToUpdate;
+    U32 loadedDictEnd;
+    S64 baseDelta;         /* window.base - dictContent */
+} ZSTD_CDictTablesHeader;
+
+static size_t ZSTD_CDictTables_blockStateOffset(void)
+{
+    return ZSTD_cwksp_align(sizeof(ZSTD_CDictTablesHeader), ZSTD_CDICT_TABLES_ALIGN);
+}
+
+static size_t ZSTD_CDictTables_hashTableOffset(void)
+{
+    return ZSTD_CDictTables_blockStateOffset()
+         + ZSTD_cwksp_align(sizeof(ZSTD_compressedBlockState_t), ZSTD_CDICT_TABLES_ALIGN);
+}
+
+static size_t ZSTD_CDictTables_size(const ZSTD_compressionParameters* cParams)
+{
+    /* same table sizes as ZSTD_reset_matchState() for ZSTD_resetTarget_CDict */
+    size_t const chainSize = (cParams->strategy == ZSTD_fast) ? 0 : ((size_t)1 << cParams->chainLog);
+    size_t const hSize = ((size_t)1) << cParams->hashLog;
+    return ZSTD_CDictTables_hashTableOffset() + (hSize + chainSize) * sizeof(U32);
+}
+
+size_t ZSTD_sizeof_CDictTables(const ZSTD_CDict* cdict)
+{
+    if (cdict==NULL) return 0;   /* support sizeof on NULL */
+    return ZSTD_CDictTables_size(&cdict->matchState.cParams);
+}
+
+size_t ZSTD_CDict_saveTables(const ZSTD_CDict* cdict, void* dst, size_t dstCapacity)
+{
+    const ZSTD_matchState_t* const ms = &cdict->matchState;
+    size_t const tablesSize = ZSTD_sizeof_CDictTables(cdict);
+    size_t const hSize = ((size_t)1) << ms->cParams.hashLog;
+    size_t const chainSize = (ms->cParams.strategy == ZSTD_fast) ? 0 : ((size_t)1 << ms->cParams.chainLog);
+    BYTE* const op = (BYTE*)dst;
+    ZSTD_CDictTablesHeader header;
+
+    RETURN_ERROR_IF(dstCapacity < tablesSize, dstSize_tooSmall, "");
+    /* content shorter than that is never indexed, window still points into the library */
+    RETURN_ERROR_IF(cdict->dictContentSize < HASH_READ_SIZE, dictionary_wrong, "nothing indexed");
+    /* a single segment can be rebased on another mapping of the same content */
+    RETURN_ERROR_IF(ms->window.lowLimit != ms->window.dictLimit, dictionary_wrong, "window has an extDict segment");
+
+    ZSTD_memset(&header, 0, sizeof(header));
+    header.magic = ZSTD_CDICT_TABLES_MAGIC;
+    header.versionNumber = ZSTD_VERSION_NUMBER;
+    header.headerSize = (U32)sizeof(header);
+    header.blockStateSize = (U32)sizeof(ZSTD_compressedBlockState_t);
+    header.dictContentSize = cdict->dictContentSize;
+    header.cParams = ms->cParams;
+    header.dictContentType = (U32)cdict->dictContentType;
+    header.dictID = cdict->dictID;
+    header.dedicatedDictSearch = (U32)ms->dedicatedDictSearch;
+    header.dictLimit = ms->window.dictLimit;
+    header.lowLimit = ms->window.lowLimit;
+    header.nextSrc = (U32)(ms->window.nextSrc - ms->window.base);
+    header.nextToUpdate = ms->nextToUpdate;
+    header.loadedDictEnd = ms->loadedDictEnd;
+    header.baseDelta = (S64)(ms->window.base - (const BYTE*)cdict->dictContent);
+
+    ZSTD_memset(op, 0, ZSTD_CDictTables_hashTableOffset());
+    ZSTD_memcpy(op, &header, sizeof(header));
+    ZSTD_memcpy(op + ZSTD_CDictTables_blockStateOffset(), &cdict->cBlockState, sizeof(cdict->cBlockState));
+    ZSTD_memcpy(op + ZSTD_CDictTables_hashTableOffset(), ms->hashTable, hSize * sizeof(U32));
+    ZSTD_memcpy(op + ZSTD_CDictTables_hashTableOffset() + hSize * sizeof(U32), ms->chainTable, chainSize * sizeof(U32));
+    return tablesSize;
+}
+
+ZSTD_CDict* ZSTD_createCDict_fromTables(const void* dictBuffer, size_t dictSize,
+                                        const void* tables, size_t tablesSize,
+                                        ZSTD_customMem customMem)
+{
+    const BYTE* const ip = (const BYTE*)tables;
+    ZSTD_CDictTablesHeader header;
+    DEBUGLOG(3, "ZSTD_createCDict_fromTables");
+    if ((!customMem.customAlloc) ^ (!customMem.customFree)) return NULL;
+    if (tables == NULL || tablesSize < ZSTD_CDictTables_hashTableOffset()) return NULL;
+    if ((size_t)tables & 7) return NULL;
+
+    ZSTD_memcpy(&header, tables, sizeof(header));
+    if (header.magic != ZSTD_CDICT_TABLES_MAGIC
+     || header.versionNumber != ZSTD_VERSION_NUMBER
+     || header.headerSize != sizeof(header)
+     || header.blockStateSize != sizeof(ZSTD_compressedBlockState_t)
+     || header.dictContentSize != dictSize) return NULL;
+    if (ZSTD_isError(ZSTD_checkCParams(header.cParams))) return NULL;
+    if (tablesSize != ZSTD_CDictTables_size(&header.cParams)) return NULL;
+    /* indexed window must lie within the dictionary content */
+    if (header.lowLimit != header.dictLimit || header.dictLimit > header.nextSrc) return NULL;
+    if (header.baseDelta + (S64)header.dictLimit < 0
+     || header.baseDelta + (S64)header.nextSrc > (S64)dictSize) return NULL;
+
+    {   size_t const workspaceSize =
+            ZSTD_cwksp_alloc_size(sizeof(ZSTD_CDict)) +
+            ZSTD_cwksp_alloc_size(HUF_WORKSPACE_SIZE);
+        void* const workspace = ZSTD_customMalloc(workspaceSize, customMem);
+        size_t const hSize = ((size_t)1) << header.cParams.hashLog;
+        ZSTD_cwksp ws;
+        ZSTD_CDict* cdict;
+        ZSTD_matchState_t* ms;
+
+        if (!workspace) return NULL;
+        ZSTD_cwksp_init(&ws, workspace, workspaceSize, ZSTD_cwksp_dynamic_alloc);
+        cdict = (ZSTD_CDict*)ZSTD_cwksp_reserve_object(&ws, sizeof(ZSTD_CDict));
+        assert(cdict != NULL);
+        ZSTD_cwksp_move(&cdict->workspace, &ws);
+        cdict->customMem = customMem;
+        cdict->compressionLevel = 0; /* signals advanced API usage */
+        cdict->dictContent = dictBuffer;
+        cdict->dictContentSize = dictSize;
+        cdict->dictContentType = (ZSTD_dictContentType_e)header.dictContentType;
+        cdict->dictID = header.dictID;
+        cdict->entropyWorkspace = (U32*)ZSTD_cwksp_reserve_object(&cdict->workspace, HUF_WORKSPACE_SIZE);
+        ZSTD_memcpy(&cdict->cBlockState, ip + ZSTD_CDictTables_blockStateOffset(), sizeof(cdict->cBlockState));
+
+        /* tables stay in the caller's buffer, a CDict only ever reads them */
+        ms = &cdict->matchState;
+        ZSTD_memset(ms, 0, sizeof(*ms));
+        ms->window.base = (const BYTE*)dictBuffer + header.baseDelta;
+        ms->window.dictBase = ms->window.base;
+        ms->window.dictLimit = header.dictLimit;
+        ms->window.lowLimit = header.lowLimit;
+        ms->window.nextSrc = ms->window.base + header.nextSrc;
+        ms->loadedDictEnd = header.loadedDictEnd;
+        ms->nextToUpdate = header.nextToUpdate;
+        ms->hashTable = (U32*)(ip + ZSTD_CDictTables_hashTableOffset());
+        ms->chainTable = ms->hashTable + hSize;
+        ms->dedicatedDictSearch = (int)header.dedicatedDictSearch;
+        ms->cParams = header.cParams;
+        return cdict;
+    }
+}
+
 /*! ZSTD_initStaticCDict_advanced() :
  *  Generate a digested dictionary in provided memory area.
  *  workspace: The memory area to emplace the dictionary into.
@@ -33,6 +33,7 @@ extern "C" {
 ***************************************/
 #define kSearchStrength      8
 #define HASH_READ_SIZE       8
+#define ZSTD_DICTWORKERS_MAX 200   /* upper bound of ZSTD_c_dictLoadWorkers */
 #define ZSTD_DUBT_UNSORTED_MARK 1   /* For btlazy2 strategy, index ZSTD_DUBT_UNSORTED_MARK==1 means "unsorted".
                                        It could be confused for a real successor at index "1", if sorted as larger than its predecessor.
                                        It's not a big deal though : candidate will just be sorted again.
@@ -246,6 +247,9 @@ struct ZSTD_CCtx_params_s {
     ZSTD_sequenceFormat_e blockDelimiters;
     int validateSequences;
 
+    /* Dictionary loading */
+    int dictLoadWorkers;
+
     /* Internal use, for createCCtxParams() and freeCCtxParams() only */
     ZSTD_customMem customMem;
 };  /* typedef'd to ZSTD_CCtx_params within "zstd.h" */
@@ -1200,4 +1204,66 @@ size_t ZSTD_referenceExternalSequences(ZSTD_CCtx* cctx, rawSeq* seq, size_t nbSe
  *  condition for correct operation : hashLog > 1 */
 U32 ZSTD_cycleLog(U32 hashLog, ZSTD_strategy strat);
 
+/* ZSTD_dictWorkers :
+ * Threads available to table filling while loading dictionary content.
+ * A NULL pointer is valid and means everything runs on the calling thread. */
+typedef struct ZSTD_dictWorkers_s ZSTD_dictWorkers;
+typedef void (*ZSTD_dictWorkers_job)(void* opaque, unsigned workerID, unsigned nbWorkers);
+
+/* ZSTD_dictWorkers_create() :
+ * @return : NULL when nbWorkers <= 1 or on allocation failure,
+ *           callers must then fall back to filling tables serially. */
+ZSTD_dictWorkers* ZSTD_dictWorkers_create(int nbWorkers, ZSTD_customMem customMem);
+void ZSTD_dictWorkers_free(ZSTD_dictWorkers* workers);
+
+/* ZSTD_dictWorkers_count() :
+ * @return : number of workers, 1 for NULL */
+unsigned ZSTD_dictWorkers_count(const ZSTD_dictWorkers* workers);
+ZSTD_customMem ZSTD_dictWorkers_customMem(const ZSTD_dictWorkers* workers);
+
+/* ZSTD_dictWorkers_run() :
+ * Calls job(opaque, workerID, nbWorkers) once for every workerID in [0, nbWorkers),
+ * and only returns once all of them have completed. */
+void ZSTD_dictWorkers_run(ZSTD_dictWorkers* workers, ZSTD_dictWorkers_job job, void* opaque);
+
+/* ZSTD_dictFillOp :
+ * One table update made while filling match state tables from a dictionary.
+ * Parallel fills replay each update on the worker owning its slot,
+ * so every slot receives the same updates in the same order as a serial fill. */
+typedef enum {
+    ZSTD_dfo_set,         /* tables[table][slot] = index */
+    ZSTD_dfo_setIfEmpty,  /* same, only if the slot is still 0 */
+    ZSTD_dfo_push         /* chainTable[index & chainMask] = tables[table][slot]; tables[table][slot] = index */
+} ZSTD_dictFillOpKind_e;
+
+typedef struct {
+    U32 slot;
+    U32 index;
+    BYTE table;
+    BYTE kind;   /* ZSTD_dictFillOpKind_e */
+} ZSTD_dictFillOp;
+
+/* Emits the ops of positions start, start+step, ... below end, in position order.
+ * @return : number of ops written, at most maxOpsPerStep for every position. */
+typedef size_t (*ZSTD_dictFill_generator)(const void* opaque, U32 start, U32 end, U32 step, ZSTD_dictFillOp* ops);
+
+typedef struct {
+    U32* tables[2];
+    U32 tableLogs[2];
+    U32* chainTable;     /* only for ZSTD_dfo_push */
+    U32 chainMask;
+    U32 chainFrom;       /* ZSTD_dfo_push below this index skips the chain write,
+                          * it must only skip writes overwritten later in the same fill */
+    ZSTD_dictFill_generator generate;
+    const void* opaque;
+    U32 step;
+    U32 maxOpsPerStep;
+} ZSTD_dictFillDesc;
+
+/* ZSTD_dictFill_parallel() :
+ * Runs the ops of positions [start, end) stepping by desc->step on workers.
+ * @return : 1 if the tables were filled, 0 when the fill is too small to split
+ *           or memory is not available, the caller must then fill serially. */
+int ZSTD_dictFill_parallel(ZSTD_dictWorkers* workers, const ZSTD_dictFillDesc* desc, U32 start, U32 end);
+
 #endif /* ZSTD_COMPRESS_H */
@@ -47,6 +47,71 @@ void ZSTD_fillDoubleHashTable(ZSTD_matchState_t* ms,
 }
 
 
+typedef struct {
+    const ZSTD_matchState_t* ms;
+    ZSTD_dictTableLoadMethod_e dtlm;
+} ZSTD_doubleFastFill_t;
+
+/* Same updates as ZSTD_fillDoubleHashTable(), as ZSTD_dictFillOp.
+ * Table 0 is hashLarge, table 1 is hashSmall. */
+static size_t ZSTD_fillDoubleHashTable_generate(const void* opaque, U32 start, U32 end, U32 step, ZSTD_dictFillOp* ops)
+{
+    const ZSTD_doubleFastFill_t* const fill = (const ZSTD_doubleFastFill_t*)opaque;
+    const BYTE* const base = fill->ms->window.base;
+    U32 const hBitsL = fill->ms->cParams.hashLog;
+    U32 const hBitsS = fill->ms->cParams.chainLog;
+    U32 const mls = fill->ms->cParams.minMatch;
+    U32 const nbPositions = fill->dtlm == ZSTD_dtlm_fast ? 1 : step;
+    size_t nbOps = 0;
+    U32 curr;
+    for (curr = start; curr < end; curr += step) {
+        U32 i;
+        for (i = 0; i < nbPositions; ++i) {
+            if (i == 0) {
+                ZSTD_dictFillOp* const op = &ops[nbOps++];
+                op->slot = (U32)ZSTD_hashPtr(base + curr, hBitsS, mls);
+                op->index = curr;
+                op->table = 1;
+                op->kind = (BYTE)ZSTD_dfo_set;
+            }
+            {   ZSTD_dictFillOp* const op = &ops[nbOps++];
+                op->slot = (U32)ZSTD_hashPtr(base + curr + i, hBitsL, 8);
+                op->index = curr + i;
+                op->table = 0;
+                op->kind = (BYTE)(i == 0 ? ZSTD_dfo_set : ZSTD_dfo_setIfEmpty);
+    }   }   }
+    return nbOps;
+}
+
+void ZSTD_fillDoubleHashTable_parallel(ZSTD_matchState_t* ms,
+                                       void const* end, ZSTD_dictTableLoadMethod_e dtlm,
+                                       ZSTD_dictWorkers* workers)
+{
+    const BYTE* const base = ms->window.base;
+    const BYTE* const iend = ((const BYTE*)end) - HASH_READ_SIZE;
+    const U32 fastHashFillStep = 3;
+
+    /* ZSTD_fillDoubleHashTable() inserts while ip + 2 <= iend */
+    if (workers != NULL && iend > base + ms->nextToUpdate + 1) {
+        ZSTD_doubleFastFill_t fill;
+        ZSTD_dictFillDesc desc;
+        fill.ms = ms;
+        fill.dtlm = dtlm;
+        ZSTD_memset(&desc, 0, sizeof(desc));
+        desc.tables[0] = ms->hashTable;
+        desc.tableLogs[0] = ms->cParams.hashLog;
+        desc.tables[1] = ms->chainTable;
+        desc.tableLogs[1] = ms->cParams.chainLog;
+        desc.generate = ZSTD_fillDoubleHashTable_generate;
+        desc.opaque = &fill;
+        desc.step = fastHashFillStep;
+        desc.maxOpsPerStep = fastHashFillStep + 1;
+        if (ZSTD_dictFill_parallel(workers, &desc, ms->nextToUpdate, (U32)(iend - base) - 1))
+            return;
+    }
+    ZSTD_fillDoubleHashTable(ms, end, dtlm);
+}
+
 FORCE_INLINE_TEMPLATE
 size_t ZSTD_compressBlock_doubleFast_generic(
         ZSTD_matchState_t* ms, seqStore_t* seqStore, U32 rep[ZSTD_REP_NUM],
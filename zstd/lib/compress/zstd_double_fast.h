@@ -20,6 +20,10 @@ extern "C" {
 
 void ZSTD_fillDoubleHashTable(ZSTD_matchState_t* ms,
                               void const* end, ZSTD_dictTableLoadMethod_e dtlm);
+/* same tables as ZSTD_fillDoubleHashTable(), filled by workers when there are several */
+void ZSTD_fillDoubleHashTable_parallel(ZSTD_matchState_t* ms,
+                              void const* end, ZSTD_dictTableLoadMethod_e dtlm,
+                              ZSTD_dictWorkers* workers);
 size_t ZSTD_compressBlock_doubleFast(
         ZSTD_matchState_t* ms, seqStore_t* seqStore, U32 rep[ZSTD_REP_NUM],
         void const* src, size_t srcSize);
@@ -43,6 +43,61 @@ void ZSTD_fillHashTable(ZSTD_matchState_t* ms,
 }
 
 
+typedef struct {
+    const ZSTD_matchState_t* ms;
+    ZSTD_dictTableLoadMethod_e dtlm;
+} ZSTD_fastFill_t;
+
+/* Same updates as ZSTD_fillHashTable(), as ZSTD_dictFillOp */
+static size_t ZSTD_fillHashTable_generate(const void* opaque, U32 start, U32 end, U32 step, ZSTD_dictFillOp* ops)
+{
+    const ZSTD_fastFill_t* const fill = (const ZSTD_fastFill_t*)opaque;
+    const BYTE* const base = fill->ms->window.base;
+    U32 const hBits = fill->ms->cParams.hashLog;
+    U32 const mls = fill->ms->cParams.minMatch;
+    U32 const nbPositions = fill->dtlm == ZSTD_dtlm_fast ? 1 : step;
+    size_t nbOps = 0;
+    U32 curr;
+    for (curr = start; curr < end; curr += step) {
+        U32 p;
+        for (p = 0; p < nbPositions; ++p) {
+            ZSTD_dictFillOp* const op = &ops[nbOps++];
+            op->slot = (U32)ZSTD_hashPtr(base + curr + p, hBits, mls);
+            op->index = curr + p;
+            op->table = 0;
+            op->kind = (BYTE)(p == 0 ? ZSTD_dfo_set : ZSTD_dfo_setIfEmpty);
+    }   }
+    return nbOps;
+}
+
+void ZSTD_fillHashTable_parallel(ZSTD_matchState_t* ms,
+                                 void const* const end,
+                                 ZSTD_dictTableLoadMethod_e dtlm,
+                                 ZSTD_dictWorkers* workers)
+{
+    const BYTE* const base = ms->window.base;
+    const BYTE* const iend = ((const BYTE*)end) - HASH_READ_SIZE;
+    const U32 fastHashFillStep = 3;
+
+    /* ZSTD_fillHashTable() inserts while ip + 1 < iend */
+    if (workers != NULL && iend > base + ms->nextToUpdate + 1) {
+        ZSTD_fastFill_t fill;
+        ZSTD_dictFillDesc desc;
+        fill.ms = ms;
+        fill.dtlm = dtlm;
+        ZSTD_memset(&desc, 0, sizeof(desc));
+        desc.tables[0] = ms->hashTable;
+        desc.tableLogs[0] = ms->cParams.hashLog;
+        desc.generate = ZSTD_fillHashTable_generate;
+        desc.opaque = &fill;
+        desc.step = fastHashFillStep;
+        desc.maxOpsPerStep = fastHashFillStep;
+        if (ZSTD_dictFill_parallel(workers, &desc, ms->nextToUpdate, (U32)(iend - base) - 1))
+            return;
+    }
+    ZSTD_fillHashTable(ms, end, dtlm);
+}
+
 FORCE_INLINE_TEMPLATE size_t
 ZSTD_compressBlock_fast_generic(
         ZSTD_matchState_t* ms, seqStore_t* seqStore, U32 rep[ZSTD_REP_NUM],
@@ -476,6 +476,55 @@ U32 ZSTD_insertAndFindFirstIndex(ZSTD_matchState_t* ms, const BYTE* ip) {
     return ZSTD_insertAndFindFirstIndex_internal(ms, cParams, ip, ms->cParams.minMatch);
 }
 
+/* Same updates as ZSTD_insertAndFindFirstIndex_internal(), as ZSTD_dictFillOp */
+static size_t ZSTD_updateHashChain_generate(const void* opaque, U32 start, U32 end, U32 step, ZSTD_dictFillOp* ops)
+{
+    const ZSTD_matchState_t* const ms = (const ZSTD_matchState_t*)opaque;
+    const BYTE* const base = ms->window.base;
+    U32 const hashLog = ms->cParams.hashLog;
+    U32 const mls = ms->cParams.minMatch;
+    size_t nbOps = 0;
+    U32 idx;
+    assert(step == 1); (void)step;
+    for (idx = start; idx < end; ++idx) {
+        ZSTD_dictFillOp* const op = &ops[nbOps++];
+        op->slot = (U32)ZSTD_hashPtr(base + idx, hashLog, mls);
+        op->index = idx;
+        op->table = 0;
+        op->kind = (BYTE)ZSTD_dfo_push;
+    }
+    return nbOps;
+}
+
+void ZSTD_updateHashChain_parallel(ZSTD_matchState_t* ms, const BYTE* ip, ZSTD_dictWorkers* workers)
+{
+    const BYTE* const base = ms->window.base;
+    U32 const target = (U32)(ip - base);
+    U32 const chainSize = 1U << ms->cParams.chainLog;
+    ZSTD_dictFillDesc desc;
+    if (workers == NULL || ms->nextToUpdate >= target) {
+        ZSTD_insertAndFindFirstIndex(ms, ip);
+        return;
+    }
+    ZSTD_memset(&desc, 0, sizeof(desc));
+    desc.tables[0] = ms->hashTable;
+    desc.tableLogs[0] = ms->cParams.hashLog;
+    desc.chainTable = ms->chainTable;
+    desc.chainMask = chainSize - 1;
+    /* older chain entries get overwritten by idx + chainSize within this update,
+     * skipping them leaves every chain slot with a single writer */
+    desc.chainFrom = target > chainSize ? target - chainSize : 0;
+    desc.generate = ZSTD_updateHashChain_generate;
+    desc.opaque = ms;
+    desc.step = 1;
+    desc.maxOpsPerStep = 1;
+    if (!ZSTD_dictFill_parallel(workers, &desc, ms->nextToUpdate, target)) {
+        ZSTD_insertAndFindFirstIndex(ms, ip);
+        return;
+    }
+    ms->nextToUpdate = target;
+}
+
 void ZSTD_dedicatedDictSearch_lazy_loadDictionary(ZSTD_matchState_t* ms, const BYTE* const ip)
 {
     const BYTE* const base = ms->window.base;
@@ -26,6 +26,9 @@ extern "C" {
 #define ZSTD_LAZY_DDSS_BUCKET_LOG 2
 
 U32 ZSTD_insertAndFindFirstIndex(ZSTD_matchState_t* ms, const BYTE* ip);
+/* updates hash chains up to ip (excluded) like ZSTD_insertAndFindFirstIndex(),
+ * filled by workers when there are several */
+void ZSTD_updateHashChain_parallel(ZSTD_matchState_t* ms, const BYTE* ip, ZSTD_dictWorkers* workers);
 
 void ZSTD_dedicatedDictSearch_lazy_loadDictionary(ZSTD_matchState_t* ms, const BYTE* const ip);
 
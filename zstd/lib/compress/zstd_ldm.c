@@ -250,6 +250,128 @@ void ZSTD_ldm_fillHashTable(
 }
 
 
+/* Positions hashed by one worker per round while filling in parallel.
+ * Tagged entries are buffered for the worst case where every position is tagged. */
+#define LDM_FILL_SLICE_SIZE (1 << 18)
+
+typedef struct {
+    U32 hash;
+    ldmEntry_t entry;
+} ldmFillEntry_t;
+
+typedef struct {
+    ldmState_t* state;
+    ldmParams_t params;
+    U32 hBits;
+    const BYTE* roundStart;
+    const BYTE* roundEnd;
+    ldmFillEntry_t* entries;   /* LDM_FILL_SLICE_SIZE entries per worker */
+    size_t* nbEntries;         /* one count per worker */
+} ldmFillJob_t;
+
+/** ZSTD_ldm_collectSlice() :
+ *  Phase 1 : hashes the slice of the round owned by workerID,
+ *  and buffers the tagged entries in position order. */
+static void ZSTD_ldm_collectSlice(void* opaque, unsigned workerID, unsigned nbWorkers)
+{
+    ldmFillJob_t* const job = (ldmFillJob_t*)opaque;
+    ldmParams_t const params = job->params;
+    const BYTE* const base = job->state->window.base;
+    const BYTE* const start = job->roundStart + (size_t)workerID * LDM_FILL_SLICE_SIZE;
+    ldmFillEntry_t* const entries = job->entries + (size_t)workerID * LDM_FILL_SLICE_SIZE;
+    size_t nbEntries = 0;
+    (void)nbWorkers;
+    if (start < job->roundEnd) {
+        const BYTE* const end = MIN(start + LDM_FILL_SLICE_SIZE, job->roundEnd);
+        U64 const tagMask = ZSTD_ldm_getTagMask(job->hBits, params.hashRateLog);
+        U64 rollingHash = ZSTD_rollingHash_compute(start, params.minMatchLength);
+        const BYTE* cur = start;
+        for (;;) {
+            if ((rollingHash & tagMask) == tagMask) {
+                ldmFillEntry_t* const e = &entries[nbEntries++];
+                e->hash = ZSTD_ldm_getSmallHash(rollingHash, job->hBits);
+                e->entry.offset = (U32)(cur - base);
+                e->entry.checksum = ZSTD_ldm_getChecksum(rollingHash, job->hBits);
+            }
+            if (++cur >= end) break;
+            rollingHash = ZSTD_rollingHash_rotate(rollingHash, cur[-1],
+                                                  cur[params.minMatchLength-1],
+                                                  job->state->hashPower);
+        }
+    }
+    job->nbEntries[workerID] = nbEntries;
+}
+
+/** ZSTD_ldm_insertOwned() :
+ *  Phase 2 : replays every buffered entry of the round in position order,
+ *  inserting only the ones whose bucket belongs to workerID.
+ *  Buckets are partitioned by hash range, so workers never share a bucket,
+ *  and every bucket sees the same insertion order as a serial fill. */
+static void ZSTD_ldm_insertOwned(void* opaque, unsigned workerID, unsigned nbWorkers)
+{
+    ldmFillJob_t* const job = (ldmFillJob_t*)opaque;
+    unsigned w;
+    for (w = 0; w < nbWorkers; ++w) {
+        ldmFillEntry_t const* const entries = job->entries + (size_t)w * LDM_FILL_SLICE_SIZE;
+        size_t const nbEntries = job->nbEntries[w];
+        size_t n;
+        for (n = 0; n < nbEntries; ++n) {
+            U32 const owner = (U32)(((U64)entries[n].hash * nbWorkers) >> job->hBits);
+            if (owner == workerID)
+                ZSTD_ldm_insertEntry(job->state, entries[n].hash, entries[n].entry, job->params);
+        }
+    }
+}
+
+void ZSTD_ldm_fillHashTableChunk(
+            ldmState_t* state, const BYTE* src, const BYTE* srcEnd,
+            const BYTE* chunkStart, const BYTE* chunkEnd,
+            ldmParams_t const* params, ZSTD_dictWorkers* workers)
+{
+    U32 const minMatch = params->minMatchLength;
+    U32 const hBits = params->hashLog - params->bucketSizeLog;
+    const BYTE* first;
+    const BYTE* last;
+    DEBUGLOG(5, "ZSTD_ldm_fillHashTableChunk");
+    if ((size_t)(srcEnd - src) < minMatch) return;
+    /* same positions as ZSTD_ldm_fillHashTable(state, src, srcEnd, params) */
+    first = MAX(chunkStart, src + 1);
+    last = MIN(chunkEnd, srcEnd - minMatch);
+    if (first >= last) return;
+
+    {   unsigned const nbWorkers = ZSTD_dictWorkers_count(workers);
+        ZSTD_customMem const customMem = ZSTD_dictWorkers_customMem(workers);
+        ldmFillJob_t job;
+        job.entries = NULL;
+        job.nbEntries = NULL;
+        if (nbWorkers > 1 && (size_t)(last - first) >= 2 * LDM_FILL_SLICE_SIZE) {
+            job.entries = (ldmFillEntry_t*)ZSTD_customMalloc((size_t)nbWorkers * LDM_FILL_SLICE_SIZE * sizeof(ldmFillEntry_t), customMem);
+            job.nbEntries = (size_t*)ZSTD_customMalloc(nbWorkers * sizeof(size_t), customMem);
+        }
+        if (job.entries == NULL || job.nbEntries == NULL) {
+            /* serial fill, also used when scratch memory is not available */
+            ZSTD_customFree(job.entries, customMem);
+            ZSTD_customFree(job.nbEntries, customMem);
+            ZSTD_ldm_fillLdmHashTable(
+                state, ZSTD_rollingHash_compute(first - 1, minMatch), first - 1, last,
+                state->window.base, hBits, *params);
+            return;
+        }
+
+        job.state = state;
+        job.params = *params;
+        job.hBits = hBits;
+        for (job.roundStart = first; job.roundStart < last; job.roundStart = job.roundEnd) {
+            job.roundEnd = job.roundStart + MIN((size_t)(last - job.roundStart),
+                                                (size_t)nbWorkers * LDM_FILL_SLICE_SIZE);
+            ZSTD_dictWorkers_run(workers, ZSTD_ldm_collectSlice, &job);
+            ZSTD_dictWorkers_run(workers, ZSTD_ldm_insertOwned, &job);
+        }
+        ZSTD_customFree(job.entries, customMem);
+        ZSTD_customFree(job.nbEntries, customMem);
+    }
+}
+
 /** ZSTD_ldm_limitTableUpdate() :
  *
  *  Sets cctx->nextToUpdate to a position corresponding closer to anchor
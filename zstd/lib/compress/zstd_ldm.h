@@ -28,6 +28,19 @@ void ZSTD_ldm_fillHashTable(
             ldmState_t* state, const BYTE* ip,
             const BYTE* iend, ldmParams_t const* params);
 
+/**
+ * ZSTD_ldm_fillHashTableChunk():
+ * Inserts the positions of [chunkStart, chunkEnd) that
+ * ZSTD_ldm_fillHashTable(state, src, srcEnd, params) would insert,
+ * so that filling consecutive chunks gives the same table as one call.
+ * Hashing and insertion are spread over `workers` when there are several,
+ * the resulting table does not depend on the number of workers.
+ */
+void ZSTD_ldm_fillHashTableChunk(
+            ldmState_t* state, const BYTE* src, const BYTE* srcEnd,
+            const BYTE* chunkStart, const BYTE* chunkEnd,
+            ldmParams_t const* params, ZSTD_dictWorkers* workers);
+
 /**
  * ZSTD_ldm_generateSequences():
  *
@@ -419,6 +419,7 @@ typedef enum {
      * ZSTD_c_stableOutBuffer
      * ZSTD_c_blockDelimiters
      * ZSTD_c_validateSequences
+     * ZSTD_c_dictLoadWorkers
      * Because they are not stable, it's necessary to define ZSTD_STATIC_LINKING_ONLY to access them.
      * note : never ever use experimentalParam? names directly;
      *        also, the enums values themselves are unstable and can still change.
@@ -434,7 +435,8 @@ typedef enum {
      ZSTD_c_experimentalParam9=1006,
      ZSTD_c_experimentalParam10=1007,
      ZSTD_c_experimentalParam11=1008,
-     ZSTD_c_experimentalParam12=1009
+     ZSTD_c_experimentalParam12=1009,
+     ZSTD_c_experimentalParam13=1010
 } ZSTD_cParameter;
 
 typedef struct {
@@ -1581,6 +1583,28 @@ ZSTDLIB_API ZSTD_CDict* ZSTD_createCDict_byReference(const void* dictBuffer, siz
  *  Non-conformant dictionaries can still be loaded, but as content-only dictionaries. */
 ZSTDLIB_API unsigned ZSTD_getDictID_fromCDict(const ZSTD_CDict* cdict);
 
+/*! ZSTD_sizeof_CDictTables() :
+ *  @return : size of the buffer ZSTD_CDict_saveTables() writes for `cdict`. */
+ZSTDLIB_API size_t ZSTD_sizeof_CDictTables(const ZSTD_CDict* cdict);
+
+/*! ZSTD_CDict_saveTables() :
+ *  Writes the loaded match state of `cdict` (parameters, window, hash and chain tables)
+ *  so it can be reused by ZSTD_createCDict_fromTables() instead of indexing the content again.
+ *  The result is only valid for the same library build and the same dictionary content.
+ * @return : number of bytes written, or an error code */
+ZSTDLIB_API size_t ZSTD_CDict_saveTables(const ZSTD_CDict* cdict, void* dst, size_t dstCapacity);
+
+/*! ZSTD_createCDict_fromTables() :
+ *  Create a digested dictionary from tables written by ZSTD_CDict_saveTables().
+ *  Both `dictBuffer` and `tables` are referenced, not duplicated,
+ *  so they **must** outlive CDict and remain unmodified throughout its lifetime.
+ *  `tables` must be aligned on 8 bytes, a memory mapped file works.
+ *  Dictionary content itself is not verified, only its size.
+ * @return : NULL if tables were written by another build, for a different dictionary size, or are corrupted */
+ZSTDLIB_API ZSTD_CDict* ZSTD_createCDict_fromTables(const void* dictBuffer, size_t dictSize,
+                                                    const void* tables, size_t tablesSize,
+                                                    ZSTD_customMem customMem);
+
 /*! ZSTD_getCParams() :
  * @return ZSTD_compressionParameters structure for a selected compression level and estimated srcSize.
  * `estimatedSrcSize` value is optional, select 0 if not known */
@@ -1832,6 +1856,21 @@ ZSTDLIB_API size_t ZSTD_CCtx_refPrefix_advanced(ZSTD_CCtx* cctx, const void* pre
  */
 #define ZSTD_c_validateSequences ZSTD_c_experimentalParam12
 
+/* ZSTD_c_dictLoadWorkers
+ * Default is 0 == load dictionary content on the calling thread.
+ *
+ * Number of threads used while indexing dictionary or prefix content.
+ * The long distance matcher table and the match finder tables of the
+ * ZSTD_fast, ZSTD_dfast, ZSTD_greedy, ZSTD_lazy and ZSTD_lazy2 strategies
+ * are filled in parallel, the binary trees of ZSTD_btlazy2 and above
+ * are still built on the calling thread.
+ * The resulting tables are identical whatever the number of workers.
+ * Only useful for large dictionaries, and requires ZSTD_MULTITHREAD,
+ * otherwise all work happens on the calling thread. No threads are started
+ * for content under 512 KB, nor when no table of the load is filled in parallel.
+ */
+#define ZSTD_c_dictLoadWorkers ZSTD_c_experimentalParam13
+
 /*! ZSTD_CCtx_getParameter() :
  *  Get the requested compression parameter value, selected by enum ZSTD_cParameter,
  *  and store it into int* value.